@@ -1,18 +1,48 @@
 #include <iostream>
 #include <memory>
 #include <vector>
-#include <string>
 #include <unordered_map>
+#include <string>
 #include <chrono>
 #include <optional>
 #include <algorithm>
 #include <mutex>
 #include <atomic>
+#include <array>
+#include <thread>
+#include <cstdint>
+#include <string_view>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <condition_variable>
+#include <type_traits>
+#include <set>
+#include <cmath>
+#include <random>
+#include <queue>
+#include <iomanip>
+#include <cstring>
+#include <tuple>
+#include <csignal>
+#include <unistd.h> // fsync, fork
+#include <sys/wait.h>
+
+#include "../Common/ClockSource.h"
 
 using TimePoint = std::chrono::system_clock::time_point;
+using TicketId = std::int64_t; // wide enough to carry shard index, slab index and a generation counter
+using ReservationId = std::int64_t; // same layout as TicketId
 
+// Where tickets get their entry/exit times (see Common/ClockSource.h). SystemClock by default, CoarseSystemClock when
+// clock reads show up in profiles (tickets are then stamped to within its resolution), VirtualClock for trace replay and tests.
+using IClock = ClockSource<std::chrono::system_clock>;
+using SystemClock = PreciseClock<std::chrono::system_clock>;
+using CoarseSystemClock = CoarseClock<std::chrono::system_clock>;
+using VirtualClock = ManualClock<std::chrono::system_clock>;
 
 enum class VehicleType{Car, Bike, Truck};
+constexpr int VEHICLE_TYPE_COUNT = 3;
 class Vehicle{
     const std::string vehicleNumber;
     const VehicleType vehicleType;
@@ -42,19 +72,52 @@ public:
 
 
 enum class SlotType{Small, Medium, Large};
+constexpr int SLOT_TYPE_COUNT = 3;
+constexpr std::array<SlotType, SLOT_TYPE_COUNT> ALL_SLOT_TYPES{SlotType::Small, SlotType::Medium, SlotType::Large}; // smallest to largest
+
+constexpr int slotTypeIndex(SlotType slotType){
+    return static_cast<int>(slotType);
+}
+
+// Row = VehicleType (Car, Bike, Truck), column = SlotType (Small, Medium, Large).
+// A constexpr table instead of if/else so the check folds away once the vehicle type is known.
+constexpr std::array<std::array<bool, SLOT_TYPE_COUNT>, VEHICLE_TYPE_COUNT> SLOT_COMPATIBILITY{{
+    {false, true,  true},  // Car
+    {true,  true,  true},  // Bike
+    {false, false, true}   // Truck
+}};
+
+// Free function so slot managers that don't go through a strategy (AtomicSlotManager) share the same rules
+constexpr bool isSlotCompatible(SlotType slotType, VehicleType vehicleType){
+    return SLOT_COMPATIBILITY[static_cast<int>(vehicleType)][slotTypeIndex(slotType)];
+}
+static_assert(isSlotCompatible(SlotType::Small, VehicleType::Bike) && !isSlotCompatible(SlotType::Medium, VehicleType::Truck),
+    "SLOT_COMPATIBILITY rows must follow VehicleType order");
+
+// Position on the floor plan, used for gate distance. Slots added without one all sit at the origin.
+struct SlotLocation{
+    double x = 0.0;
+    double y = 0.0;
+};
+
 class ParkingSlot{
     const int slotId;
     const SlotType slotType;
+    const SlotLocation location;
     bool isOccupied;
 
 public:
-    ParkingSlot(int slotId, SlotType slotType) : slotId(slotId), slotType(slotType), isOccupied(false){}
+    ParkingSlot(int slotId, SlotType slotType, SlotLocation location = {}) : slotId(slotId), slotType(slotType), location(location), isOccupied(false){}
 
     // Getters
     int getSlotId() const{
         return slotId;
     }
 
+    SlotLocation getLocation() const{
+        return location;
+    }
+
     SlotType getSlotType() const{
         return slotType;
     }
@@ -74,10 +137,48 @@ public:
 
 };
 
+// Plates are short, so a Ticket keeps them inline in a fixed-width buffer instead of an owned std::string.
+// That keeps Ticket free of heap allocations and lets TicketStore hold tickets directly in its slab.
+// Longer plates don't fit and are refused at the door (VehicleNumberIndex won't claim them): truncating would make
+// two plates sharing a 15-character prefix the same vehicle.
+class VehicleNumber{
+public:
+    static constexpr std::size_t MAX_LENGTH = 15;
+
+    static bool fits(std::string_view number){
+        return number.size() <= MAX_LENGTH;
+    }
+
+private:
+    std::array<char, MAX_LENGTH> chars{};
+    std::uint8_t length = 0;
+
+public:
+    VehicleNumber() = default;
+    // Callers check fits() first, a longer number would be cut to MAX_LENGTH
+    explicit VehicleNumber(std::string_view number) : length(static_cast<std::uint8_t>(std::min(number.size(), MAX_LENGTH))){
+        std::copy_n(number.data(), length, chars.data());
+    }
+
+    std::string_view view() const{
+        return std::string_view(chars.data(), length);
+    }
+
+    bool operator==(const VehicleNumber& other) const{
+        return view() == other.view();
+    }
+};
+
+struct VehicleNumberHash{
+    std::size_t operator()(const VehicleNumber& vehicleNumber) const{
+        return std::hash<std::string_view>{}(vehicleNumber.view());
+    }
+};
+
 class Ticket{
     // inline static int nextTicketId = 1; // property of class rather than object, but not doing this because not thread-safe
-    const int ticketId;
-    const std::string vehicleNumber;
+    const TicketId ticketId;
+    const VehicleNumber vehicleNumber;
     const int slotId;
     const SlotType slotType;
     const TimePoint entryTime;
@@ -85,21 +186,22 @@ class Ticket{
     std::optional<TimePoint> exitTime; // Better option than sentinal(preffered in Modern cpp)
 
 public:
-    Ticket(int ticketId, const std::string& vehicleNumber, int slotId, SlotType slotType) :
+    // entryTime comes from the lot's IClock (or the journal on recovery), never straight from system_clock
+    Ticket(TicketId ticketId, std::string_view vehicleNumber, int slotId, SlotType slotType, TimePoint entryTime) :
     // nextTicketId(nextTicketId ++) -> wrong because static cannot be initialised in constructor
     ticketId(ticketId),
     vehicleNumber(vehicleNumber),
     slotId(slotId),
     slotType(slotType),
-    entryTime(std::chrono::system_clock::now()){}
+    entryTime(entryTime){}
 
     // Getters
-    int getTicketId() const {
+    TicketId getTicketId() const {
         return ticketId;
     }
 
-    const std::string& getVehicleNumber() const {
-        return vehicleNumber;
+    std::string_view getVehicleNumber() const {
+        return vehicleNumber.view();
     }
 
     int getSlotId() const {
@@ -123,9 +225,9 @@ public:
         return exitTime.has_value(); // works with std::optinal<T>
     }
 
-    bool closeTicket(){
+    bool closeTicket(TimePoint closedAt){
         if(!isClosed()){
-            exitTime = std::chrono::system_clock::now();
+            exitTime = closedAt;
             return true;
         }
         std::cout << "Ticket already closed\n";
@@ -133,190 +235,3615 @@ public:
     }
 };
 
+// Free slots bucketed by SlotType so allocation never has to scan the whole lot.
+// Each bucket is a stack of slotIds; positionInBucket lets us remove any slot in O(1) by swapping it with the back.
+class FreeSlotIndex{
+    std::array<std::vector<int>, SLOT_TYPE_COUNT> freeSlots;
+    std::vector<int> positionInBucket; // indexed by slotId, -1 when the slot is not free
+
+public:
+    void addFreeSlot(int slotId, SlotType slotType){
+        if(slotId >= static_cast<int>(positionInBucket.size())) positionInBucket.resize(slotId + 1, -1);
+        if(positionInBucket[slotId] != -1) return; // already free, don't index it twice
+        auto& bucket = freeSlots[slotTypeIndex(slotType)];
+        positionInBucket[slotId] = static_cast<int>(bucket.size());
+        bucket.push_back(slotId);
+    }
+
+    bool removeFreeSlot(int slotId, SlotType slotType){
+        if(slotId >= static_cast<int>(positionInBucket.size()) || positionInBucket[slotId] == -1) return false;
+        auto& bucket = freeSlots[slotTypeIndex(slotType)];
+        int pos = positionInBucket[slotId];
+        int lastSlotId = bucket.back();
+        bucket[pos] = lastSlotId; // swap-with-back so removal stays O(1)
+        positionInBucket[lastSlotId] = pos;
+        bucket.pop_back();
+        positionInBucket[slotId] = -1;
+        return true;
+    }
+
+    // Returns -1 when no slot of this type is free
+    int peekFreeSlot(SlotType slotType) const{
+        const auto& bucket = freeSlots[slotTypeIndex(slotType)];
+        return bucket.empty() ? -1 : bucket.back();
+    }
+
+    int getFreeCount(SlotType slotType) const{
+        return static_cast<int>(freeSlots[slotTypeIndex(slotType)].size());
+    }
+};
+
 class ISlotSelectionStrategy{
 protected:
     bool isSlotCompatible(const SlotType slotype, const VehicleType vehicleType) const{ // const is required because isSlotCompatible will be used inside selectSlot which is a const function and a const function can only call const functions
-        if(vehicleType == VehicleType::Bike) return true;
-        else if(vehicleType == VehicleType::Car) return slotype != SlotType::Small;
-        else return slotype == SlotType::Large;
+        return ::isSlotCompatible(slotype, vehicleType);
     }
 public:
     ISlotSelectionStrategy() = default;
     virtual ~ISlotSelectionStrategy() = default;
-    virtual int selectSlot(const std::unordered_map<int, ParkingSlot*>& slotsMap, VehicleType vehicleType) const = 0;
+    // Strategies only read the free index, SlotManager owns it and keeps it in sync with occupancy.
+    // gateId is the entry gate the vehicle came through, only location aware strategies use it.
+    virtual int selectSlot(const FreeSlotIndex& freeSlotIndex, VehicleType vehicleType, int gateId) const = 0;
+
+    // Stateful strategies keep their own view of the free slots through these; SlotManager calls them under its lock
+    virtual void onSlotAdded(int /*slotId*/, SlotType /*slotType*/, SlotLocation /*location*/){}
+    virtual void onSlotOccupied(int /*slotId*/, SlotType /*slotType*/){}
+    virtual void onSlotReleased(int /*slotId*/, SlotType /*slotType*/){}
 };
 
 
-class FirstAvailableStrategy : public ISlotSelectionStrategy{
+// Strategies are final so a BasicSlotManager holding one by value calls selectSlot directly (and inlines it)
+
+// Picks the lowest slotId among the compatible buckets' next free slots, so still "first" without any scan
+class FirstAvailableStrategy final : public ISlotSelectionStrategy{
+public:
+    int selectSlot(const FreeSlotIndex& freeSlotIndex, VehicleType vehicleType, int /*gateId*/) const override{
+        int selectedSlotId = -1;
+        for(SlotType slotType : ALL_SLOT_TYPES){
+            if(!isSlotCompatible(slotType, vehicleType)) continue;
+            int slotId = freeSlotIndex.peekFreeSlot(slotType);
+            if(slotId != -1 && (selectedSlotId == -1 || slotId < selectedSlotId)) selectedSlotId = slotId;
+        }
+        return selectedSlotId;
+    }
+};
+
+class SmallestFitStrategy final : public ISlotSelectionStrategy{
 public:
-    int selectSlot(const std::unordered_map<int, ParkingSlot*>& slotsMap, VehicleType vehicleType) const override{
-        for(const auto &[slotId, slotDetails] : slotsMap){
-            if(!slotDetails->isSlotOccupied() 
-                && isSlotCompatible(slotDetails -> getSlotType(), vehicleType)){
-                    return slotId;
+    int selectSlot(const FreeSlotIndex& freeSlotIndex, VehicleType vehicleType, int /*gateId*/) const override{
+        for(SlotType slotType : ALL_SLOT_TYPES){ // ALL_SLOT_TYPES is ordered from smallest to largest
+            if(isSlotCompatible(slotType, vehicleType) && freeSlotIndex.getFreeCount(slotType) > 0){
+                return freeSlotIndex.peekFreeSlot(slotType);
             }
         }
         return -1;
     }
 };
 
-class SmallestFitStrategy : public ISlotSelectionStrategy{
+// Closest free compatible slot to the vehicle's entry gate (Manhattan distance, cars drive along aisles).
+// Keeps, per gate and per SlotType, an ordered set of {distance, slotId} of the free slots, so the nearest one is begin()
+// and occupy/release are O(gates * log N) instead of scanning every slot.
+class NearestToGateStrategy final : public ISlotSelectionStrategy{
+    using DistanceQueue = std::set<std::pair<double, int>>;
+
+    std::vector<SlotLocation> gateLocations;
+    std::vector<std::array<DistanceQueue, SLOT_TYPE_COUNT>> freeSlotsByGate; // [gateId][slotType]
+    std::vector<SlotLocation> slotLocations; // indexed by slotId
+
+    static double distance(const SlotLocation& from, const SlotLocation& to){
+        return std::abs(from.x - to.x) + std::abs(from.y - to.y);
+    }
+
 public:
-    int selectSlot(const std::unordered_map<int, ParkingSlot*>& slotsMap, VehicleType vehicleType) const override{
-        int slot1 = -1, slot2 = -1, slot3 = -1;
-        for(const auto &[slotId, slotDetails] : slotsMap){
-            if(!slotDetails->isSlotOccupied() 
-                && isSlotCompatible(slotDetails -> getSlotType(), vehicleType)){
-                    if(slotDetails -> getSlotType() == SlotType::Small) slot1 = slotId;
-                    else if(slotDetails -> getSlotType() == SlotType::Medium) slot2 = slotId;
-                    else slot3 = slotId;
+    explicit NearestToGateStrategy(std::vector<SlotLocation> gateLocations) :
+        gateLocations(gateLocations.empty() ? std::vector<SlotLocation>{SlotLocation{}} : std::move(gateLocations)),
+        freeSlotsByGate(this -> gateLocations.size()){}
+
+    // Unknown gates fall back to gate 0. Ties between slot types go to the smaller one.
+    int selectSlot(const FreeSlotIndex& /*freeSlotIndex*/, VehicleType vehicleType, int gateId) const override{
+        if(gateId < 0 || gateId >= static_cast<int>(gateLocations.size())) gateId = 0;
+        int selectedSlotId = -1;
+        double selectedDistance = 0.0;
+        for(SlotType slotType : ALL_SLOT_TYPES){
+            if(!isSlotCompatible(slotType, vehicleType)) continue;
+            const DistanceQueue& freeSlots = freeSlotsByGate[gateId][slotTypeIndex(slotType)];
+            if(freeSlots.empty()) continue;
+            const auto& [slotDistance, slotId] = *freeSlots.begin();
+            if(selectedSlotId == -1 || slotDistance < selectedDistance){
+                selectedSlotId = slotId;
+                selectedDistance = slotDistance;
             }
         }
-        if(slot1 != -1) return slot1;
-        else if(slot2 != -1) return slot2;
-        else return slot3;
+        return selectedSlotId;
+    }
+
+    void onSlotAdded(int slotId, SlotType slotType, SlotLocation location) override{
+        if(slotId >= static_cast<int>(slotLocations.size())) slotLocations.resize(slotId + 1);
+        slotLocations[slotId] = location;
+        onSlotReleased(slotId, slotType); // new slots start free
+    }
+
+    void onSlotOccupied(int slotId, SlotType slotType) override{
+        for(std::size_t gateId = 0; gateId < gateLocations.size(); gateId++){
+            freeSlotsByGate[gateId][slotTypeIndex(slotType)].erase({distance(gateLocations[gateId], slotLocations[slotId]), slotId});
+        }
+    }
+
+    void onSlotReleased(int slotId, SlotType slotType) override{
+        for(std::size_t gateId = 0; gateId < gateLocations.size(); gateId++){
+            freeSlotsByGate[gateId][slotTypeIndex(slotType)].insert({distance(gateLocations[gateId], slotLocations[slotId]), slotId});
+        }
+    }
+};
+
+// Runtime-swappable policy for BasicSlotManager: one virtual selectSlot per allocation, strategy can change while running
+class DynamicSlotSelection{
+    std::unique_ptr<ISlotSelectionStrategy> strategy;
+
+public:
+    DynamicSlotSelection() : strategy(std::make_unique<FirstAvailableStrategy>()){}
+    // implicit (and templated so make_unique<SmallestFitStrategy>() converts directly) so SlotManager(unique_ptr) and updateStartegy(unique_ptr) keep working
+    template<typename ConcreteStrategy>
+    DynamicSlotSelection(std::unique_ptr<ConcreteStrategy> strategy) : strategy(std::move(strategy)){}
+
+    int selectSlot(const FreeSlotIndex& freeSlotIndex, VehicleType vehicleType, int gateId) const{
+        return strategy -> selectSlot(freeSlotIndex, vehicleType, gateId);
+    }
+
+    void onSlotAdded(int slotId, SlotType slotType, SlotLocation location){
+        strategy -> onSlotAdded(slotId, slotType, location);
+    }
+
+    void onSlotOccupied(int slotId, SlotType slotType){
+        strategy -> onSlotOccupied(slotId, slotType);
+    }
+
+    void onSlotReleased(int slotId, SlotType slotType){
+        strategy -> onSlotReleased(slotId, slotType);
     }
 };
 
 // Don't make slotmanager singleton as it will over complicate the design and is not ideal. The main orchasterator is ParkingLotSystem. It can be made as a singleton
-class SlotManager{
-    std::unordered_map<int, std::unique_ptr<ParkingSlot>> slotsMap;
-    std::unique_ptr<ISlotSelectionStrategy> slotSelectionStrategy;
+// Strategy is a policy type with `int selectSlot(const FreeSlotIndex&, VehicleType, int gateId) const` and the
+// onSlotAdded/onSlotOccupied/onSlotReleased hooks (every ISlotSelectionStrategy has them).
+// BasicSlotManager<SmallestFitStrategy> calls it on a by-value final object, so there is no virtual dispatch in allocateSlot;
+// SlotManager (= BasicSlotManager<DynamicSlotSelection>) keeps the runtime-swappable strategy.
+template<typename Strategy>
+class BasicSlotManager{
+    std::vector<ParkingSlot> slots; // slotId - 1 is the index, ids are handed out sequentially
+    FreeSlotIndex freeSlotIndex;
+    Strategy slotSelectionStrategy;
     mutable std::mutex mtx;
 
+    ParkingSlot* findSlot(int slotId){
+        if(slotId < 1 || slotId > static_cast<int>(slots.size())) return nullptr;
+        return &slots[slotId - 1];
+    }
+
 public:
-    SlotManager() : slotSelectionStrategy(std::make_unique<FirstAvailableStrategy>()){}
-    explicit SlotManager(std::unique_ptr<ISlotSelectionStrategy> strategy) : slotSelectionStrategy(std::move(strategy)){}
+    BasicSlotManager() = default;
+    explicit BasicSlotManager(Strategy strategy) : slotSelectionStrategy(std::move(strategy)){}
 
-    void addParkingSlot(SlotType slotType){
+    void addParkingSlot(SlotType slotType, SlotLocation location = {}){
         std::lock_guard<std::mutex> guard(mtx);
-        int slotId = slotsMap.size() + 1;
-        slotsMap[slotId] = std::make_unique<ParkingSlot>(slotId, slotType);
+        int slotId = slots.size() + 1;
+        slots.emplace_back(slotId, slotType, location);
+        freeSlotIndex.addFreeSlot(slotId, slotType);
+        slotSelectionStrategy.onSlotAdded(slotId, slotType, location);
     }
     
     // void removeParkingSlot(int slotId){} -> remove this as it will overcomplicate
 
-    void updateStartegy(std::unique_ptr<ISlotSelectionStrategy> strategy){
+    void updateStartegy(Strategy strategy){
+        std::lock_guard<std::mutex> guard(mtx); // allocateSlot reads the strategy under the same lock
         slotSelectionStrategy = std::move(strategy);
+        // a fresh strategy knows nothing about the lot yet, replay the slots and their occupancy into it
+        for(const ParkingSlot& slot : slots){
+            slotSelectionStrategy.onSlotAdded(slot.getSlotId(), slot.getSlotType(), slot.getLocation());
+            if(slot.isSlotOccupied()) slotSelectionStrategy.onSlotOccupied(slot.getSlotId(), slot.getSlotType());
+        }
     }
 
     // {SlotId and SlotType} required for parkingLotSystem class. Also could have returned struct SlotView{int slotId, SlotType slot}
-    std::optional<std::pair<int, SlotType>> allocateSlot(VehicleType vehicleType){
+    std::optional<std::pair<int, SlotType>> allocateSlot(VehicleType vehicleType, int gateId = 0){
         std::lock_guard<std::mutex> guard(mtx);
-        // Very important as selectSlot take Parking* as argument and not std::unique_ptr<ParkingSlot>
-        std::unordered_map<int, ParkingSlot*> slotViewMap;
-        for(auto &[slotId, slotDetails] : slotsMap){
-            slotViewMap[slotId] = slotDetails.get();
-            // slotDetails is: std::unique_ptr<ParkingSlot>
-            // get() returns: ParkingSlot*
-            // “Give me the raw pointer to the object you own, without transferring ownership.”
-        }
-        int selectedSlotId = slotSelectionStrategy -> selectSlot(slotViewMap, vehicleType);
+        int selectedSlotId = slotSelectionStrategy.selectSlot(freeSlotIndex, vehicleType, gateId);
         if(selectedSlotId != -1){
-            slotsMap[selectedSlotId] -> occupySlot();
-            SlotType slotType = slotsMap[selectedSlotId] -> getSlotType();
-            return std::make_pair(selectedSlotId, slotType);
+            ParkingSlot* slot = findSlot(selectedSlotId);
+            slot -> occupySlot();
+            freeSlotIndex.removeFreeSlot(selectedSlotId, slot -> getSlotType());
+            slotSelectionStrategy.onSlotOccupied(selectedSlotId, slot -> getSlotType());
+            return std::make_pair(selectedSlotId, slot -> getSlotType());
         }
         return std::nullopt; // required as it will lead to undefined value if not returned
     }
 
+    // Marks the next free slot of exactly this SlotType as held for a reservation (occupied, but with no ticket yet).
+    // The hold ends with releaseSlot when it lapses, or turns into a ticket on claim without another allocation.
+    std::optional<int> holdSlot(SlotType slotType){
+        std::lock_guard<std::mutex> guard(mtx);
+        int slotId = freeSlotIndex.peekFreeSlot(slotType);
+        if(slotId == -1) return std::nullopt;
+        findSlot(slotId) -> occupySlot();
+        freeSlotIndex.removeFreeSlot(slotId, slotType);
+        slotSelectionStrategy.onSlotOccupied(slotId, slotType);
+        return slotId;
+    }
+
+    // Occupies one specific slot, used when occupancy is rebuilt from the journal
+    bool occupySlot(int slotId){
+        std::lock_guard<std::mutex> guard(mtx);
+        ParkingSlot* slot = findSlot(slotId);
+        if(slot == nullptr || slot -> isSlotOccupied()) return false;
+        slot -> occupySlot();
+        freeSlotIndex.removeFreeSlot(slotId, slot -> getSlotType());
+        slotSelectionStrategy.onSlotOccupied(slotId, slot -> getSlotType());
+        return true;
+    }
+
     bool releaseSlot(int slotId){
         std::lock_guard<std::mutex> guard(mtx);
-        if(slotsMap.count(slotId) != 0){
-            slotsMap[slotId] -> vacateSlot(); // a common trap of not checking if slotId exist or not
-            return true;
+        ParkingSlot* slot = findSlot(slotId); // a common trap of not checking if slotId exist or not
+        if(slot == nullptr || !slot -> isSlotOccupied()) return false; // double release would index the slot twice
+        slot -> vacateSlot();
+        freeSlotIndex.addFreeSlot(slotId, slot -> getSlotType());
+        slotSelectionStrategy.onSlotReleased(slotId, slot -> getSlotType());
+        return true;
+    }
+
+    int getFreeCount(SlotType slotType) const{
+        std::lock_guard<std::mutex> guard(mtx);
+        return freeSlotIndex.getFreeCount(slotType);
+    }
+};
+
+using SlotManager = BasicSlotManager<DynamicSlotSelection>;
+
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// 64 slots per word, one word per cache line so gates claiming from different words never false-share
+struct alignas(CACHE_LINE_SIZE) OccupancyWord{
+    std::atomic<uint64_t> bits{0}; // bit set -> slot occupied
+};
+
+// Lock-free alternative to SlotManager for high-contention entry gates.
+// Occupancy lives in one atomic bitmap per SlotType instead of ParkingSlot::isOccupied, so
+// allocateSlot is find-first-zero + CAS and releaseSlot is a single fetch_and; neither ever takes a mutex.
+// Capacity is fixed at construction because the bitmaps can't be grown safely while gates are claiming from them.
+// Slot ids are contiguous per type: Small slots first, then Medium, then Large.
+class AtomicSlotManager{
+    struct SlotBitmap{
+        std::unique_ptr<OccupancyWord[]> words;
+        int wordCount = 0;
+        int slotCount = 0;
+        int firstSlotId = 0;
+        std::atomic<int> searchHint{0}; // word of the last successful claim, spreads threads out and skips full words
+    };
+
+    std::array<SlotBitmap, SLOT_TYPE_COUNT> bitmaps;
+    int totalSlots = 0;
+
+    static constexpr int BITS_PER_WORD = 64;
+
+    std::optional<int> tryClaim(SlotBitmap& bitmap){
+        if(bitmap.wordCount == 0) return std::nullopt;
+        int start = bitmap.searchHint.load(std::memory_order_relaxed);
+        for(int i = 0; i < bitmap.wordCount; i++){
+            int wordIndex = (start + i) % bitmap.wordCount;
+            std::atomic<uint64_t>& word = bitmap.words[wordIndex].bits;
+            uint64_t current = word.load(std::memory_order_relaxed);
+            while(current != ~0ULL){
+                int bit = __builtin_ctzll(~current); // find-first-zero
+                uint64_t desired = current | (1ULL << bit);
+                // on failure current is reloaded, so we retry against what the other gate just wrote
+                if(word.compare_exchange_weak(current, desired, std::memory_order_acq_rel, std::memory_order_relaxed)){
+                    if(wordIndex != start) bitmap.searchHint.store(wordIndex, std::memory_order_relaxed);
+                    return bitmap.firstSlotId + wordIndex * BITS_PER_WORD + bit;
+                }
+            }
         }
-        return false;
+        return std::nullopt;
+    }
+
+    // Maps a slotId back to its bitmap, nullptr for unknown ids
+    SlotBitmap* findBitmap(int slotId, SlotType& slotType){
+        for(SlotType type : ALL_SLOT_TYPES){
+            SlotBitmap& bitmap = bitmaps[slotTypeIndex(type)];
+            if(slotId >= bitmap.firstSlotId && slotId < bitmap.firstSlotId + bitmap.slotCount){
+                slotType = type;
+                return &bitmap;
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    AtomicSlotManager(int smallSlots, int mediumSlots, int largeSlots){
+        const std::array<int, SLOT_TYPE_COUNT> counts{smallSlots, mediumSlots, largeSlots};
+        int nextSlotId = 1;
+        for(SlotType slotType : ALL_SLOT_TYPES){
+            SlotBitmap& bitmap = bitmaps[slotTypeIndex(slotType)];
+            bitmap.slotCount = std::max(0, counts[slotTypeIndex(slotType)]);
+            bitmap.wordCount = (bitmap.slotCount + BITS_PER_WORD - 1) / BITS_PER_WORD;
+            bitmap.firstSlotId = nextSlotId;
+            bitmap.words = std::make_unique<OccupancyWord[]>(bitmap.wordCount);
+            int tailBits = bitmap.slotCount % BITS_PER_WORD;
+            if(tailBits != 0){
+                // bits past the last real slot are marked occupied so they can never be handed out
+                bitmap.words[bitmap.wordCount - 1].bits.store(~0ULL << tailBits, std::memory_order_relaxed);
+            }
+            nextSlotId += bitmap.slotCount;
+        }
+        totalSlots = nextSlotId - 1;
+    }
+
+    AtomicSlotManager(const AtomicSlotManager&) = delete;
+    AtomicSlotManager& operator=(const AtomicSlotManager&) = delete;
+
+    // Same smallest-fit order as SmallestFitStrategy
+    std::optional<std::pair<int, SlotType>> allocateSlot(VehicleType vehicleType){
+        for(SlotType slotType : ALL_SLOT_TYPES){
+            if(!isSlotCompatible(slotType, vehicleType)) continue;
+            std::optional<int> slotId = tryClaim(bitmaps[slotTypeIndex(slotType)]);
+            if(slotId.has_value()) return std::make_pair(slotId.value(), slotType);
+        }
+        return std::nullopt;
+    }
+
+    bool releaseSlot(int slotId){
+        SlotType slotType;
+        SlotBitmap* bitmap = findBitmap(slotId, slotType);
+        if(bitmap == nullptr) return false;
+        int offset = slotId - bitmap -> firstSlotId;
+        uint64_t mask = 1ULL << (offset % BITS_PER_WORD);
+        uint64_t previous = bitmap -> words[offset / BITS_PER_WORD].bits.fetch_and(~mask, std::memory_order_release);
+        return (previous & mask) != 0; // false on double release
+    }
+
+    bool isSlotOccupied(int slotId){
+        SlotType slotType;
+        SlotBitmap* bitmap = findBitmap(slotId, slotType);
+        if(bitmap == nullptr) return false;
+        int offset = slotId - bitmap -> firstSlotId;
+        return (bitmap -> words[offset / BITS_PER_WORD].bits.load(std::memory_order_acquire) >> (offset % BITS_PER_WORD)) & 1ULL;
+    }
+
+    // O(slots / 64) popcount, a shared free counter would put every gate back on one contended cache line
+    int getFreeCount(SlotType slotType) const{
+        const SlotBitmap& bitmap = bitmaps[slotTypeIndex(slotType)];
+        int occupied = 0;
+        for(int i = 0; i < bitmap.wordCount; i++){
+            occupied += __builtin_popcountll(bitmap.words[i].bits.load(std::memory_order_relaxed));
+        }
+        int paddingBits = bitmap.wordCount * BITS_PER_WORD - bitmap.slotCount;
+        return bitmap.slotCount - (occupied - paddingBits);
+    }
+
+    int getTotalSlots() const{
+        return totalSlots;
     }
 };
 
-// a stub for now
-double getParkingPrice(int minutes){
-    return 100.0;
-}
+// Human friendly tariff for one SlotType, compiled into Tariff's flat tables once
+struct SlotTariff{
+    std::vector<std::pair<int, double>> bands{{0, 40.0}}; // {startMinuteOfDay, ratePerHour}, a band runs until the next one starts
+    double dailyCap = 400.0; // max charged for any 24h stretch of the stay
+    int graceMinutes = 10;   // stays up to this long are free
+};
 
-class ParkingLotSystem{
-    std::unique_ptr<SlotManager> slotManager;
-    std::unordered_map<int, std::unique_ptr<Ticket>> activeTicketsMap;
-    // inline static int nextTicketId = 1 -> this won't be thread-safe
-    std::atomic<int> nextTicketId{1}; //std::atomic<int> provides a thread-safe integer where reads and writes are performed atomically, without using explicit locks.
-    mutable std::mutex mtx;
+// Replaces the old getParkingPrice stub.
+// For every SlotType the time-of-day bands are pre-integrated into a per-minute prefix sum spanning two days,
+// so the cost of any window shorter than a day is cumulative[start + length] - cumulative[start] with no wrap-around branch.
+// Pricing a stay is then a couple of loads and arithmetic: full days * capped day cost + capped remainder, zero inside grace.
+// Minute-of-day is UTC shifted by utcOffsetMinutes.
+class Tariff{
+    static constexpr int MINUTES_PER_DAY = 24 * 60;
+    static constexpr int TABLE_STRIDE = 2 * MINUTES_PER_DAY + 1;
+
+    std::vector<double> cumulativeCost; // SLOT_TYPE_COUNT tables of TABLE_STRIDE, one flat allocation
+    std::array<double, SLOT_TYPE_COUNT> dailyCap{};
+    std::array<double, SLOT_TYPE_COUNT> fullDayCost{}; // min(cost of 24h, dailyCap)
+    std::array<long long, SLOT_TYPE_COUNT> graceMinutes{};
+    const int utcOffsetMinutes;
+
+    long long toMinuteOfDay(TimePoint timePoint) const{
+        long long minutes = std::chrono::duration_cast<std::chrono::minutes>(timePoint.time_since_epoch()).count() + utcOffsetMinutes;
+        return ((minutes % MINUTES_PER_DAY) + MINUTES_PER_DAY) % MINUTES_PER_DAY;
+    }
 
-    ParkingLotSystem() : slotManager(std::make_unique<SlotManager>()){}
+    double priceMinutes(int typeIndex, long long entryMinuteOfDay, long long durationMinutes) const{
+        const double* cumulative = cumulativeCost.data() + typeIndex * TABLE_STRIDE;
+        long long fullDays = durationMinutes / MINUTES_PER_DAY;
+        long long remainder = durationMinutes % MINUTES_PER_DAY;
+        double partial = std::min(cumulative[entryMinuteOfDay + remainder] - cumulative[entryMinuteOfDay], dailyCap[typeIndex]);
+        double total = fullDays * fullDayCost[typeIndex] + partial;
+        return durationMinutes > graceMinutes[typeIndex] ? total : 0.0;
+    }
 
 public:
-    ParkingLotSystem(const ParkingLotSystem&) = delete;
-    ParkingLotSystem& operator=(const ParkingLotSystem&) = delete;
+    explicit Tariff(const std::array<SlotTariff, SLOT_TYPE_COUNT>& slotTariffs, int utcOffsetMinutes = 0) :
+        cumulativeCost(SLOT_TYPE_COUNT * TABLE_STRIDE, 0.0),
+        utcOffsetMinutes(utcOffsetMinutes){
+        for(int typeIndex = 0; typeIndex < SLOT_TYPE_COUNT; typeIndex++){
+            const SlotTariff& slotTariff = slotTariffs[typeIndex];
+            auto bands = slotTariff.bands;
+            std::sort(bands.begin(), bands.end());
 
-    static ParkingLotSystem& getInstance(){
-        static ParkingLotSystem instance;
+            // expand bands into a per-minute rate, minutes before the first band belong to the last one (it wraps from yesterday)
+            std::array<double, MINUTES_PER_DAY> ratePerMinute{};
+            for(int minute = 0; minute < MINUTES_PER_DAY; minute++){
+                double ratePerHour = bands.empty() ? 0.0 : bands.back().second;
+                for(const auto& [startMinute, rate] : bands){
+                    if(startMinute <= minute) ratePerHour = rate;
+                }
+                ratePerMinute[minute] = ratePerHour / 60.0;
+            }
+
+            double* cumulative = cumulativeCost.data() + typeIndex * TABLE_STRIDE;
+            for(int minute = 0; minute < 2 * MINUTES_PER_DAY; minute++){
+                cumulative[minute + 1] = cumulative[minute] + ratePerMinute[minute % MINUTES_PER_DAY];
+            }
+
+            dailyCap[typeIndex] = slotTariff.dailyCap;
+            fullDayCost[typeIndex] = std::min(cumulative[MINUTES_PER_DAY], slotTariff.dailyCap);
+            graceMinutes[typeIndex] = slotTariff.graceMinutes;
+        }
+    }
+
+    // Used until a lot calls setTariff: 20/40/80 per hour for Small/Medium/Large all day, 10 free minutes, cap of 10 hours
+    static std::shared_ptr<const Tariff> defaultTariff(){
+        static const std::shared_ptr<const Tariff> instance = std::make_shared<const Tariff>(std::array<SlotTariff, SLOT_TYPE_COUNT>{
+            SlotTariff{{{0, 20.0}}, 200.0, 10},
+            SlotTariff{{{0, 40.0}}, 400.0, 10},
+            SlotTariff{{{0, 80.0}}, 800.0, 10}
+        });
         return instance;
     }
 
-    void addParkingSlot(SlotType slotType){
-        std::lock_guard<std::mutex> guard(mtx);
-        slotManager -> addParkingSlot(slotType);
+    double price(SlotType slotType, TimePoint entryTime, TimePoint exitTime) const{
+        long long durationMinutes = std::max<long long>(0, std::chrono::duration_cast<std::chrono::minutes>(exitTime - entryTime).count());
+        return priceMinutes(slotTypeIndex(slotType), toMinuteOfDay(entryTime), durationMinutes);
     }
 
-    void setSlotSelectionStrategy(std::unique_ptr<ISlotSelectionStrategy> strategy){
-        slotManager -> updateStartegy(std::move(strategy));
+    // Open tickets cost nothing yet
+    double priceTicket(const Ticket& ticket) const{
+        std::optional<TimePoint> exitTime = ticket.getExitTime();
+        if(!exitTime.has_value()) return 0.0;
+        return price(ticket.getSlotType(), ticket.getEntryTime(), exitTime.value());
     }
 
-    int parkVehicle(const std::string& vehicleNumber, VehicleType vehicleType){
-         // Step 1: allocate slot (SlotManager handles its own locking)
-        auto allocated = slotManager->allocateSlot(vehicleType);
-        if (!allocated.has_value()) {
-            return -1;
+    // End-of-day reconciliation: re-bills a whole day's closed tickets against the flat tables, 256 at a time.
+    // A first pass pulls type, entry minute and duration out of each ticket (the optional exit time and the chrono
+    // conversions live here); the second prices them in a straight-line loop over those arrays, with the cap and
+    // grace period as min/select rather than branches. prices must have room for count values.
+    // Pointer + count stands in for span<const Ticket>, which C++17 doesn't have; the vector overload wraps it.
+    void priceTickets(const Ticket* tickets, std::size_t count, double* prices) const{
+        constexpr std::size_t CHUNK = 256;
+        std::array<int, CHUNK> typeIndexes;
+        std::array<long long, CHUNK> entryMinutes;
+        std::array<long long, CHUNK> durations;
+        for(std::size_t begin = 0; begin < count; begin += CHUNK){
+            const std::size_t chunkSize = std::min(CHUNK, count - begin);
+            for(std::size_t i = 0; i < chunkSize; i++){
+                const Ticket& ticket = tickets[begin + i];
+                TimePoint entryTime = ticket.getEntryTime();
+                TimePoint exitTime = ticket.getExitTime().value_or(entryTime); // open tickets price as zero minutes
+                typeIndexes[i] = slotTypeIndex(ticket.getSlotType());
+                entryMinutes[i] = toMinuteOfDay(entryTime);
+                durations[i] = std::max<long long>(0, std::chrono::duration_cast<std::chrono::minutes>(exitTime - entryTime).count());
+            }
+            for(std::size_t i = 0; i < chunkSize; i++){
+                prices[begin + i] = priceMinutes(typeIndexes[i], entryMinutes[i], durations[i]);
+            }
         }
+    }
 
-        // Step 2: create ticket under ParkingLotSystem lock
-        std::lock_guard<std::mutex> guard(mtx);
+    std::vector<double> priceTickets(const std::vector<Ticket>& tickets) const{
+        std::vector<double> prices(tickets.size());
+        priceTickets(tickets.data(), tickets.size(), prices.data());
+        return prices;
+    }
+};
+
+// Slab of ticket cells indexed directly by the ticket id, replacing unordered_map<int, unique_ptr<Ticket>>.
+// Closed cells go on a free list and are reused, so once the slab has grown to the number of concurrently
+// open tickets park/unpark never touch the allocator. Every reuse bumps the cell's generation, which is part
+// of the ticket id, so a stale or already-closed ticket id is rejected instead of closing someone else's ticket.
+// Id layout (low to high): shardBits of shard index | SLAB_INDEX_BITS of cell index | generation.
+// Not thread-safe, the owning ParkingShard guards it with its lock.
+class TicketStore{
+    static constexpr int SLAB_INDEX_BITS = 24; // up to ~16M open tickets per shard
+    static constexpr std::uint32_t MAX_GENERATION = (1u << 30) - 1; // keeps ids positive with up to 8 shard bits
+
+    struct Cell{
+        std::uint32_t generation = 1;
+        std::optional<Ticket> ticket;
+    };
+
+    const int shardIndex;
+    const int shardBits;
+    std::vector<Cell> cells;
+    std::vector<std::uint32_t> freeCells; // stack of reusable cell indexes
 
-        int ticketId = nextTicketId++;
+    TicketId makeTicketId(std::uint32_t cellIndex, std::uint32_t generation) const{
+        return (static_cast<TicketId>(generation) << (SLAB_INDEX_BITS + shardBits))
+            | (static_cast<TicketId>(cellIndex) << shardBits)
+            | shardIndex;
+    }
+
+    // nullptr unless the id points at a live cell of this shard with a matching generation
+    Cell* findCell(TicketId ticketId){
+        if(ticketId <= 0 || (ticketId & ((TicketId{1} << shardBits) - 1)) != shardIndex) return nullptr;
+        std::uint64_t cellIndex = (ticketId >> shardBits) & ((TicketId{1} << SLAB_INDEX_BITS) - 1);
+        std::uint64_t generation = ticketId >> (SLAB_INDEX_BITS + shardBits);
+        if(cellIndex >= cells.size()) return nullptr;
+        Cell& cell = cells[cellIndex];
+        if(cell.generation != generation || !cell.ticket.has_value()) return nullptr;
+        return &cell;
+    }
+
+public:
+    TicketStore(int shardIndex, int shardBits) : shardIndex(shardIndex), shardBits(shardBits){}
+
+    // Open tickets can never outnumber slots, so reserving to the slot count makes steady state allocation free.
+    // Grows at least 2x, slots are added one at a time and an exact reserve would reallocate on every one.
+    void reserve(std::size_t capacity){
+        if(capacity <= cells.capacity()) return;
+        capacity = std::min<std::size_t>(std::max(capacity, 2 * cells.capacity()), std::size_t{1} << SLAB_INDEX_BITS);
+        cells.reserve(capacity);
+        freeCells.reserve(capacity);
+    }
 
-        auto ticket = std::make_unique<Ticket>(
-            ticketId,
-            vehicleNumber,
-            allocated->first,   // slotId
-            allocated->second   // slotType
-        );
+    // Returns -1 when the slab is full
+    TicketId emplace(std::string_view vehicleNumber, int slotId, SlotType slotType, TimePoint entryTime){
+        std::uint32_t cellIndex;
+        if(!freeCells.empty()){
+            cellIndex = freeCells.back();
+            freeCells.pop_back();
+        }
+        else if(cells.size() < (std::size_t{1} << SLAB_INDEX_BITS)){
+            cellIndex = static_cast<std::uint32_t>(cells.size());
+            cells.emplace_back();
+        }
+        else return -1;
 
-        activeTicketsMap[ticketId] = std::move(ticket);
+        Cell& cell = cells[cellIndex];
+        TicketId ticketId = makeTicketId(cellIndex, cell.generation);
+        cell.ticket.emplace(ticketId, vehicleNumber, slotId, slotType, entryTime);
         return ticketId;
     }
 
-    double unparkVehicle(int ticketId){
+    const Ticket* find(TicketId ticketId){
+        Cell* cell = findCell(ticketId);
+        return cell == nullptr ? nullptr : &cell -> ticket.value();
+    }
 
-        std::lock_guard<std::mutex> guard(mtx); // required because If a data structure is protected by a mutex in one method, it must be protected in all methods that read/write it.
-        // also Two threads could call unparkVehicle(ticketId) at the same time; Both pass count(ticketId) != 0; One moves the ticket, the other accesses a moved-from entry
+    // Hands the ticket back by value (no heap inside it any more) and recycles the cell
+    std::optional<Ticket> release(TicketId ticketId){
+        Cell* cell = findCell(ticketId);
+        if(cell == nullptr) return std::nullopt;
+        std::optional<Ticket> ticket = std::move(cell -> ticket);
+        cell -> ticket.reset();
+        cell -> generation = nextGeneration(cell -> generation);
+        freeCells.push_back(static_cast<std::uint32_t>(cell - cells.data()));
+        return ticket;
+    }
 
-        if(activeTicketsMap.count(ticketId) != 0){
-            std::unique_ptr <Ticket> closingTicket = std::move(activeTicketsMap[ticketId]);
-            activeTicketsMap.erase(ticketId);
+    std::size_t size() const{
+        return cells.size() - freeCells.size();
+    }
 
-            // Slot can be release immediately and biling is independent and hence can be done afterwards
-            int slotID = closingTicket -> getSlotId();
-            slotManager -> releaseSlot(slotID);
+    std::uint32_t cellIndexOf(TicketId ticketId) const{
+        return static_cast<std::uint32_t>((ticketId >> shardBits) & ((TicketId{1} << SLAB_INDEX_BITS) - 1));
+    }
+
+    std::uint32_t generationOf(TicketId ticketId) const{
+        return static_cast<std::uint32_t>(ticketId >> (SLAB_INDEX_BITS + shardBits));
+    }
+
+    std::uint32_t nextGeneration(std::uint32_t generation) const{
+        return generation == MAX_GENERATION ? 1 : generation + 1;
+    }
+
+    // -------- Snapshot / recovery --------
+
+    std::vector<std::uint32_t> getGenerations() const{
+        std::vector<std::uint32_t> generations(cells.size());
+        for(std::size_t i = 0; i < cells.size(); i++) generations[i] = cells[i].generation;
+        return generations;
+    }
+
+    template<typename Visitor>
+    void forEachTicket(Visitor visitor) const{
+        for(const Cell& cell : cells){
+            if(cell.ticket.has_value()) visitor(cell.ticket.value());
+        }
+    }
+
+    // Recovery only: call restoreCell/restoreTicket on an empty store, then rebuildFreeList once
+    void restoreCell(std::uint32_t cellIndex, std::uint32_t generation){
+        if(cellIndex >= cells.size()) cells.resize(cellIndex + 1);
+        cells[cellIndex].generation = generation;
+    }
+
+    bool restoreTicket(const Ticket& ticket){
+        std::uint32_t cellIndex = cellIndexOf(ticket.getTicketId());
+        if(cellIndex >= (std::uint32_t{1} << SLAB_INDEX_BITS)) return false;
+        restoreCell(cellIndex, generationOf(ticket.getTicketId()));
+        cells[cellIndex].ticket.emplace(ticket);
+        return true;
+    }
+
+    void rebuildFreeList(){
+        freeCells.clear();
+        freeCells.reserve(cells.capacity());
+        for(std::size_t i = cells.size(); i-- > 0;){ // lowest index ends on top of the stack
+            if(!cells[i].ticket.has_value()) freeCells.push_back(static_cast<std::uint32_t>(i));
+        }
+    }
+};
+
+// Plate -> active ticket id, shared by every shard of a lot so the same plate can't be parked twice anywhere.
+// Striped: each stripe has its own lock and table, so gates looking up different plates rarely contend.
+// Each stripe is an open-addressing table (linear probing, backward-shift erase), so claim/erase write entries in
+// place. addCapacity sizes the tables from the lot's slot count, plates being parked never outnumber slots for long,
+// so steady state park/unpark never touch the allocator. A stripe that hashes unevenly still grows 2x on its own.
+class VehicleNumberIndex{
+    static constexpr std::size_t STRIPE_COUNT = 64;
+    static constexpr std::size_t MIN_STRIPE_CAPACITY = 16;
+    static constexpr TicketId PENDING = 0; // plate claimed, park still in progress
+
+    struct Entry{
+        VehicleNumber plate;
+        TicketId ticketId = PENDING;
+        bool used = false;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Stripe{
+        mutable std::mutex mtx;
+        std::vector<Entry> entries = std::vector<Entry>(MIN_STRIPE_CAPACITY); // power of two, at most 3/4 used
+        std::size_t used = 0;
+    };
+
+    std::array<Stripe, STRIPE_COUNT> stripes;
+    std::mutex capacityMtx; // only addCapacity, taken before any stripe lock
+    std::size_t expectedPlates = 0;
+    std::size_t stripeCapacity = MIN_STRIPE_CAPACITY;
+
+    static std::size_t hashOf(const VehicleNumber& vehicleNumber){
+        return VehicleNumberHash{}(vehicleNumber);
+    }
+
+    // Low bits pick the stripe, the rest pick the home entry inside it
+    static std::size_t homeOf(std::size_t hash, std::size_t mask){
+        return (hash / STRIPE_COUNT) & mask;
+    }
 
-            closingTicket -> closeTicket();
+    // Index of the plate's entry, or of the empty entry where it would go
+    static std::size_t probe(const Stripe& stripe, const VehicleNumber& vehicleNumber, std::size_t hash){
+        std::size_t mask = stripe.entries.size() - 1;
+        std::size_t i = homeOf(hash, mask);
+        while(stripe.entries[i].used && !(stripe.entries[i].plate == vehicleNumber)) i = (i + 1) & mask;
+        return i;
+    }
 
-            TimePoint entryTime = closingTicket -> getEntryTime();
-            std::optional<TimePoint> exitTime = closingTicket -> getExitTime();
+    static void rehash(Stripe& stripe, std::size_t capacity){
+        std::vector<Entry> old(capacity);
+        old.swap(stripe.entries);
+        for(const Entry& entry : old){
+            if(entry.used) stripe.entries[probe(stripe, entry.plate, hashOf(entry.plate))] = entry;
+        }
+    }
 
-            if(exitTime.has_value()){
-                auto mins = std::chrono::duration_cast<std::chrono::minutes>(exitTime.value() - entryTime).count();
-                double price = getParkingPrice(mins);
-                return price;
+    // Pulls later entries of the probe run back into the hole, so lookups never need tombstones
+    static void eraseAt(Stripe& stripe, std::size_t hole){
+        std::size_t mask = stripe.entries.size() - 1;
+        for(std::size_t i = (hole + 1) & mask; stripe.entries[i].used; i = (i + 1) & mask){
+            std::size_t home = homeOf(hashOf(stripe.entries[i].plate), mask);
+            if(((i - home) & mask) >= ((i - hole) & mask)){ // the hole sits between i's home and i
+                stripe.entries[hole] = stripe.entries[i];
+                hole = i;
             }
-            else return 0.0;
         }
-        else return 0.0;
+        stripe.entries[hole].used = false;
+        stripe.used--;
+    }
+
+    // Caller holds stripe.mtx; hash is the plate's hash
+    static Entry& insert(Stripe& stripe, const VehicleNumber& vehicleNumber, std::size_t hash){
+        if((stripe.used + 1) * 4 > stripe.entries.size() * 3) rehash(stripe, stripe.entries.size() * 2);
+        Entry& entry = stripe.entries[probe(stripe, vehicleNumber, hash)];
+        entry.plate = vehicleNumber;
+        entry.ticketId = PENDING;
+        entry.used = true;
+        stripe.used++;
+        return entry;
+    }
+
+public:
+    // Called once per slot added to the lot. Sizes every stripe so the average one stays under 3/8 full, the 3/4
+    // growth point leaves 2x headroom for uneven hashing. Stripes only grow, and only when the size crosses a power of two.
+    void addCapacity(std::size_t plates){
+        std::lock_guard<std::mutex> capacityGuard(capacityMtx);
+        expectedPlates += plates;
+        std::size_t perStripe = expectedPlates / STRIPE_COUNT + 1;
+        std::size_t capacity = stripeCapacity;
+        while(capacity * 3 < perStripe * 8) capacity *= 2;
+        if(capacity == stripeCapacity) return;
+        stripeCapacity = capacity;
+        for(Stripe& stripe : stripes){
+            std::lock_guard<std::mutex> guard(stripe.mtx);
+            if(stripe.entries.size() < capacity) rehash(stripe, capacity);
+        }
+    }
+
+    // Reserves the plate before a slot is allocated, false if it is already parked (or being parked) or too long to store
+    bool tryClaim(std::string_view plate){
+        if(!VehicleNumber::fits(plate)) return false;
+        VehicleNumber vehicleNumber(plate);
+        std::size_t hash = hashOf(vehicleNumber);
+        Stripe& stripe = stripes[hash % STRIPE_COUNT];
+        std::lock_guard<std::mutex> guard(stripe.mtx);
+        if(stripe.entries[probe(stripe, vehicleNumber, hash)].used) return false;
+        insert(stripe, vehicleNumber, hash);
+        return true;
+    }
+
+    void assign(std::string_view plate, TicketId ticketId){
+        VehicleNumber vehicleNumber(plate);
+        std::size_t hash = hashOf(vehicleNumber);
+        Stripe& stripe = stripes[hash % STRIPE_COUNT];
+        std::lock_guard<std::mutex> guard(stripe.mtx);
+        Entry* entry = &stripe.entries[probe(stripe, vehicleNumber, hash)];
+        if(!entry -> used) entry = &insert(stripe, vehicleNumber, hash);
+        entry -> ticketId = ticketId;
+    }
+
+    // Only erases when the plate still maps to ticketId, a later park of the same plate is left alone
+    void erase(std::string_view plate, TicketId ticketId){
+        VehicleNumber vehicleNumber(plate);
+        std::size_t hash = hashOf(vehicleNumber);
+        Stripe& stripe = stripes[hash % STRIPE_COUNT];
+        std::lock_guard<std::mutex> guard(stripe.mtx);
+        std::size_t i = probe(stripe, vehicleNumber, hash);
+        if(stripe.entries[i].used && stripe.entries[i].ticketId == ticketId) eraseAt(stripe, i);
+    }
+
+    // Undo tryClaim when the park failed
+    void releaseClaim(std::string_view plate){
+        erase(plate, PENDING);
+    }
+
+    std::optional<TicketId> findTicket(std::string_view plate) const{
+        if(!VehicleNumber::fits(plate)) return std::nullopt; // never parked, and must not match a plate it shares a prefix with
+        VehicleNumber vehicleNumber(plate);
+        std::size_t hash = hashOf(vehicleNumber);
+        const Stripe& stripe = stripes[hash % STRIPE_COUNT];
+        std::lock_guard<std::mutex> guard(stripe.mtx);
+        const Entry& entry = stripe.entries[probe(stripe, vehicleNumber, hash)];
+        if(!entry.used || entry.ticketId == PENDING) return std::nullopt;
+        return entry.ticketId;
     }
 };
 
-int main() {
+// Hierarchical timing wheel driving reservation expiry: LEVELS x 64 slots, level k slots are 64^k ticks wide.
+// schedule/cancel are O(1) (entries live in a slab with intrusive prev/next links); each tick only touches what
+// expires plus the occasional cascade of one higher-level slot. Handles carry a generation, so cancelling a timer
+// that already fired is a harmless no-op. A background thread advances the wheel and calls onExpired outside the lock.
+// Time comes from the lot's IClock (setClock), so a VirtualClock drives expiries in tests and replays; the thread
+// still wakes every tickDuration of real time to look at it. Catching up skips straight to the next tick that has an
+// occupied slot or a cascade to do, so a clock that jumps days (or a 1.7e9 s trace timestamp) costs no more than one
+// step per occupied slot.
+class ReservationTimer{
+public:
+    using TimerHandle = std::uint64_t;
 
-    
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS_PER_LEVEL = 1 << SLOT_BITS;
+    static constexpr std::uint64_t HORIZON_TICKS = std::uint64_t{1} << (SLOT_BITS * LEVELS); // ~194 days at 1s ticks
+    static constexpr std::int32_t NONE = -1;
+
+    struct Entry{
+        std::uint64_t expiryTick = 0;
+        std::int64_t payload = 0;
+        std::int32_t prev = NONE;
+        std::int32_t next = NONE;
+        std::int32_t list = NONE; // index into heads, NONE when the entry is free
+        std::uint32_t generation = 1;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<std::int32_t> freeEntries;
+    std::array<std::int32_t, LEVELS * SLOTS_PER_LEVEL> heads;
+    std::uint64_t currentTick = 0;
+    const std::chrono::milliseconds tickDuration;
+    std::shared_ptr<const IClock> clock = SystemClock::instance(); // under mtx
+    TimePoint startTime; // tick 0 on clock, under mtx
+    const std::function<void(std::int64_t)> onExpired;
+    std::vector<std::int64_t> expired; // reused every tick
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread ticker;
+
+    void link(std::int32_t index){
+        Entry& entry = entries[index];
+        std::uint64_t delta = entry.expiryTick - currentTick;
+        // beyond the horizon: park in the farthest slot, the cascade re-links it once it gets closer
+        std::uint64_t slotTick = delta >= HORIZON_TICKS ? currentTick + HORIZON_TICKS - 1 : entry.expiryTick;
+        delta = slotTick - currentTick;
+        int level = 0;
+        while(level < LEVELS - 1 && delta >= (std::uint64_t{1} << (SLOT_BITS * (level + 1)))) level++;
+        int list = level * SLOTS_PER_LEVEL + static_cast<int>((slotTick >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1));
+        entry.list = list;
+        entry.prev = NONE;
+        entry.next = heads[list];
+        if(heads[list] != NONE) entries[heads[list]].prev = index;
+        heads[list] = index;
+    }
+
+    void unlink(std::int32_t index){
+        Entry& entry = entries[index];
+        if(entry.prev != NONE) entries[entry.prev].next = entry.next;
+        else heads[entry.list] = entry.next;
+        if(entry.next != NONE) entries[entry.next].prev = entry.prev;
+        entry.list = NONE;
+    }
+
+    void freeEntry(std::int32_t index){
+        entries[index].generation++;
+        freeEntries.push_back(index);
+    }
+
+    // The first tick in (currentTick, targetTick] that has something to expire or cascade, targetTick if none does.
+    // Level k entries sit in the slot their tick maps to at 64^k granularity, so only the boundaries of occupied
+    // slots matter; level 0 holds at most the next 64 ticks.
+    std::uint64_t nextBusyTick(std::uint64_t targetTick) const{
+        if(entries.size() == freeEntries.size()) return targetTick; // nothing scheduled
+        std::uint64_t next = targetTick;
+        for(int level = 0; level < LEVELS; level++){
+            const int shift = SLOT_BITS * level;
+            std::uint64_t tick = ((currentTick >> shift) + 1) << shift; // the next tick this level acts on
+            for(int step = 0; step < SLOTS_PER_LEVEL && tick < next; step++, tick += std::uint64_t{1} << shift){
+                if(heads[level * SLOTS_PER_LEVEL + static_cast<int>((tick >> shift) & (SLOTS_PER_LEVEL - 1))] != NONE){
+                    next = tick;
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    void advanceTo(std::uint64_t targetTick){
+        while(currentTick < targetTick){
+            currentTick = nextBusyTick(targetTick) - 1; // the ticks skipped had empty slots, stepping them would do nothing
+            advanceOneTick();
+        }
+    }
+
+    void advanceOneTick(){
+        currentTick++;
+        // highest level first, so entries it moves down into level k-1's current slot are cascaded again right after
+        for(int level = LEVELS - 1; level >= 1; level--){
+            if((currentTick & ((std::uint64_t{1} << (SLOT_BITS * level)) - 1)) != 0) continue;
+            int list = level * SLOTS_PER_LEVEL + static_cast<int>((currentTick >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1));
+            std::int32_t index = heads[list];
+            heads[list] = NONE;
+            while(index != NONE){
+                std::int32_t next = entries[index].next;
+                link(index);
+                index = next;
+            }
+        }
+        int list = static_cast<int>(currentTick & (SLOTS_PER_LEVEL - 1));
+        std::int32_t index = heads[list];
+        heads[list] = NONE;
+        while(index != NONE){
+            std::int32_t next = entries[index].next;
+            entries[index].list = NONE;
+            expired.push_back(entries[index].payload);
+            freeEntry(index);
+            index = next;
+        }
+    }
+
+    // Deadlines round up and the wheel's own clock rounds down, so nothing ever lapses before its deadline
+    std::uint64_t toTick(TimePoint timePoint, bool roundUp) const{
+        if(timePoint <= startTime) return 0;
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(timePoint - startTime).count();
+        auto tick = std::chrono::duration_cast<std::chrono::microseconds>(tickDuration).count();
+        return static_cast<std::uint64_t>(roundUp ? (elapsed + tick - 1) / tick : elapsed / tick);
+    }
+
+    void tickerLoop(){
+        std::unique_lock<std::mutex> lock(mtx);
+        while(!stopping){
+            cv.wait_for(lock, tickDuration);
+            std::uint64_t targetTick = toTick(clock -> now(), false);
+            advanceTo(targetTick);
+            if(expired.empty()) continue;
+            std::vector<std::int64_t> firing;
+            firing.swap(expired);
+            lock.unlock(); // onExpired takes shard locks, and claim paths call cancel() while holding them
+            for(std::int64_t payload : firing) onExpired(payload);
+            lock.lock();
+            firing.clear();
+            if(expired.empty()) expired.swap(firing); // hand the buffer back so it keeps its capacity
+        }
+    }
+
+public:
+    ReservationTimer(std::chrono::milliseconds tickDuration, std::function<void(std::int64_t)> onExpired) :
+        tickDuration(std::max(tickDuration, std::chrono::milliseconds(1))),
+        startTime(clock -> now()),
+        onExpired(std::move(onExpired)){
+        heads.fill(NONE);
+        ticker = std::thread(&ReservationTimer::tickerLoop, this);
+    }
+
+    ReservationTimer(const ReservationTimer&) = delete;
+    ReservationTimer& operator=(const ReservationTimer&) = delete;
+
+    ~ReservationTimer(){
+        stop();
+    }
+
+    // Joins the thread, no expiry fires after this returns. For owners whose callbacks' targets go away first.
+    void stop(){
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            stopping = true;
+        }
+        cv.notify_one();
+        if(ticker.joinable()) ticker.join();
+    }
+
+    // Re-bases tick 0 so the current tick is "now" on the new clock; pending holds keep their remaining tick count
+    void setClock(std::shared_ptr<const IClock> newClock){
+        std::lock_guard<std::mutex> guard(mtx);
+        clock = std::move(newClock);
+        startTime = clock -> now() - std::chrono::duration_cast<TimePoint::duration>(tickDuration * currentTick);
+    }
+
+    TimerHandle schedule(std::int64_t payload, TimePoint deadline){
+        std::lock_guard<std::mutex> guard(mtx);
+        std::int32_t index;
+        if(!freeEntries.empty()){
+            index = freeEntries.back();
+            freeEntries.pop_back();
+        }
+        else{
+            index = static_cast<std::int32_t>(entries.size());
+            entries.emplace_back();
+        }
+        Entry& entry = entries[index];
+        entry.expiryTick = std::max(toTick(deadline, true), currentTick + 1); // a deadline already passed lapses on the next tick
+        entry.payload = payload;
+        link(index);
+        return (static_cast<TimerHandle>(entry.generation) << 32) | static_cast<std::uint32_t>(index);
+    }
+
+    bool cancel(TimerHandle handle){
+        std::lock_guard<std::mutex> guard(mtx);
+        std::int32_t index = static_cast<std::int32_t>(handle & 0xffffffffu);
+        std::uint32_t generation = static_cast<std::uint32_t>(handle >> 32);
+        if(index < 0 || index >= static_cast<std::int32_t>(entries.size())) return false;
+        Entry& entry = entries[index];
+        if(entry.generation != generation || entry.list == NONE) return false;
+        unlink(index);
+        freeEntry(index);
+        return true;
+    }
+};
+
+struct Reservation{
+    VehicleNumber vehicleNumber;
+    int slotId = 0;
+    SlotType slotType = SlotType::Small;
+    TimePoint deadline;
+    ReservationTimer::TimerHandle timer = 0;
+};
+
+// Open holds of one shard: slab + free list + generation like TicketStore, ids use the same layout (low bits = shard).
+// Not thread-safe, ParkingShard guards it with its reservation lock.
+class ReservationBook{
+    static constexpr int SLAB_INDEX_BITS = 24;
+    static constexpr std::uint32_t MAX_GENERATION = (1u << 30) - 1;
+
+    struct Cell{
+        std::uint32_t generation = 1;
+        std::optional<Reservation> reservation;
+    };
+
+    const int shardIndex;
+    const int shardBits;
+    std::vector<Cell> cells;
+    std::vector<std::uint32_t> freeCells;
+
+    Cell* findCell(ReservationId reservationId){
+        if(reservationId <= 0 || (reservationId & ((ReservationId{1} << shardBits) - 1)) != shardIndex) return nullptr;
+        std::uint64_t cellIndex = (reservationId >> shardBits) & ((ReservationId{1} << SLAB_INDEX_BITS) - 1);
+        std::uint64_t generation = reservationId >> (SLAB_INDEX_BITS + shardBits);
+        if(cellIndex >= cells.size()) return nullptr;
+        Cell& cell = cells[cellIndex];
+        if(cell.generation != generation || !cell.reservation.has_value()) return nullptr;
+        return &cell;
+    }
+
+public:
+    ReservationBook(int shardIndex, int shardBits) : shardIndex(shardIndex), shardBits(shardBits){}
+
+    // Returns -1 when the slab is full
+    ReservationId emplace(const Reservation& reservation){
+        std::uint32_t cellIndex;
+        if(!freeCells.empty()){
+            cellIndex = freeCells.back();
+            freeCells.pop_back();
+        }
+        else if(cells.size() < (std::size_t{1} << SLAB_INDEX_BITS)){
+            cellIndex = static_cast<std::uint32_t>(cells.size());
+            cells.emplace_back();
+        }
+        else return -1;
+        Cell& cell = cells[cellIndex];
+        cell.reservation = reservation;
+        return (static_cast<ReservationId>(cell.generation) << (SLAB_INDEX_BITS + shardBits))
+            | (static_cast<ReservationId>(cellIndex) << shardBits)
+            | shardIndex;
+    }
+
+    void setTimer(ReservationId reservationId, ReservationTimer::TimerHandle timer){
+        Cell* cell = findCell(reservationId);
+        if(cell != nullptr) cell -> reservation -> timer = timer;
+    }
+
+    std::optional<Reservation> release(ReservationId reservationId){
+        Cell* cell = findCell(reservationId);
+        if(cell == nullptr) return std::nullopt;
+        std::optional<Reservation> reservation = cell -> reservation;
+        cell -> reservation.reset();
+        cell -> generation = cell -> generation == MAX_GENERATION ? 1 : cell -> generation + 1;
+        freeCells.push_back(static_cast<std::uint32_t>(cell - cells.data()));
+        return reservation;
+    }
+
+    std::size_t size() const{
+        return cells.size() - freeCells.size();
+    }
+};
+
+enum class JournalEventType : std::uint8_t{Park = 1, Unpark = 2};
+
+// Fixed-size POD, journal and snapshot files are plain arrays of these and are read back with a single fread
+struct JournalRecord{
+    TicketId ticketId = 0;
+    std::int64_t entryTimeTicks = 0; // system_clock ticks since epoch, files are not portable across platforms
+    std::int32_t slotId = 0;
+    JournalEventType eventType = JournalEventType::Park;
+    std::uint8_t slotType = 0;
+    std::uint8_t plateLength = 0;
+    char plate[VehicleNumber::MAX_LENGTH] = {};
+
+    static JournalRecord fromTicket(JournalEventType eventType, const Ticket& ticket){
+        JournalRecord record;
+        record.ticketId = ticket.getTicketId();
+        record.entryTimeTicks = ticket.getEntryTime().time_since_epoch().count();
+        record.slotId = ticket.getSlotId();
+        record.eventType = eventType;
+        record.slotType = static_cast<std::uint8_t>(ticket.getSlotType());
+        std::string_view plate = ticket.getVehicleNumber();
+        record.plateLength = static_cast<std::uint8_t>(plate.size());
+        std::copy_n(plate.data(), plate.size(), record.plate);
+        return record;
+    }
+
+    Ticket toTicket() const{
+        return Ticket(ticketId,
+            std::string_view(plate, std::min<std::size_t>(plateLength, VehicleNumber::MAX_LENGTH)),
+            slotId,
+            static_cast<SlotType>(slotType),
+            TimePoint(TimePoint::duration(entryTimeTicks)));
+    }
+};
+static_assert(std::is_trivially_copyable<JournalRecord>::value, "JournalRecord is written to disk with fwrite");
+
+// Append-only, group-committed journal of park/unpark events for one shard.
+// The hot path only copies a record into an in-memory buffer; a writer thread swaps the buffer out every
+// commitInterval (or once GROUP_COMMIT_RECORDS are queued) and writes + fsyncs the whole batch at once.
+// Files: <base>.journal-<epoch>. A snapshot tagged with epoch E holds everything appended before journal E,
+// so recovery = load snapshot, then replay journal E, E+1, ... A torn record at the end of a file is ignored.
+class TicketJournal{
+    static constexpr std::size_t GROUP_COMMIT_RECORDS = 4096;
+    static constexpr std::uint64_t SNAPSHOT_MAGIC = 0x504b4c534e415031ULL;
+
+    struct SnapshotHeader{
+        std::uint64_t magic = SNAPSHOT_MAGIC;
+        std::uint64_t epoch = 0;
+        std::uint64_t cellCount = 0;
+        std::uint64_t recordCount = 0;
+    };
+
+    const std::string basePath;
+    std::uint64_t epoch;     // appends go to this journal, under mtx
+    std::uint64_t fileEpoch; // the journal file is open on, under fileMtx; behind epoch while a rotation is being committed
+    std::FILE* file = nullptr;
+    std::FILE* nextFile = nullptr; // journal fileEpoch + 1, opened by prepareRotation, under fileMtx
+    bool rotationPrepared = false; // nextFile is open and no rotation is in flight, under mtx
+    std::vector<JournalRecord> pending; // filled by gates
+    std::vector<JournalRecord> closing; // appended before the last rotate(), still owed to the previous file, under mtx
+    std::vector<JournalRecord> writing; // drained by whoever holds fileMtx, swapped with pending so capacity is reused
+    std::vector<JournalRecord> writingClosing; // same for closing
+    std::mutex fileMtx; // whoever writes to or swaps the file; always taken before mtx
+    std::mutex mtx;     // guards pending, closing, epoch and stopping, the only lock the hot path takes
+    std::condition_variable cv;
+    bool stopping = false;
+    const std::chrono::milliseconds commitInterval;
+    const std::chrono::milliseconds snapshotInterval;
+    const std::function<void()> onSnapshotDue; // runs on the writer thread, never on a gate
+    std::thread writer;
+
+    static void syncAndClose(std::FILE* f){
+        std::fflush(f);
+        ::fsync(fileno(f));
+        std::fclose(f);
+    }
+
+    static void writeAndSync(std::FILE* f, std::vector<JournalRecord>& records){
+        if(records.empty() || f == nullptr) return;
+        std::fwrite(records.data(), sizeof(JournalRecord), records.size(), f);
+        std::fflush(f);
+        ::fsync(fileno(f));
+        records.clear();
+    }
+
+    // Requires fileMtx. Takes mtx only for the buffer swap so appends keep flowing during the write.
+    // Also finishes a rotation: what was appended before it goes to the old file, which is then closed.
+    void commitPending(){
+        std::uint64_t appendEpoch;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            std::swap(pending, writing);
+            std::swap(closing, writingClosing);
+            appendEpoch = epoch;
+        }
+        if(appendEpoch != fileEpoch){
+            writeAndSync(file, writingClosing);
+            if(file != nullptr) std::fclose(file); // synced just above
+            file = nextFile;
+            nextFile = nullptr;
+            fileEpoch = appendEpoch;
+        }
+        writeAndSync(file, writing);
+    }
+
+    void writerLoop(){
+        auto lastSnapshot = std::chrono::steady_clock::now();
+        while(true){
+            bool stop;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait_for(lock, commitInterval, [this](){ return stopping || pending.size() >= GROUP_COMMIT_RECORDS; });
+                stop = stopping;
+            }
+            {
+                std::lock_guard<std::mutex> fileGuard(fileMtx);
+                commitPending();
+            }
+            if(stop) return;
+            if(onSnapshotDue && std::chrono::steady_clock::now() - lastSnapshot >= snapshotInterval){
+                onSnapshotDue();
+                lastSnapshot = std::chrono::steady_clock::now();
+            }
+        }
+    }
+
+    static std::vector<JournalRecord> readJournal(const std::string& path){
+        std::vector<JournalRecord> records;
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        if(ec) return records;
+        records.resize(size / sizeof(JournalRecord)); // a torn trailing record is dropped here
+        std::FILE* f = std::fopen(path.c_str(), "rb");
+        if(f == nullptr) return {};
+        records.resize(std::fread(records.data(), sizeof(JournalRecord), records.size(), f));
+        std::fclose(f);
+        return records;
+    }
+
+public:
+    // State rebuilt by recover(), indexed by slab cell: at most one open ticket per cell (ticketId 0 = none)
+    struct RecoveredState{
+        std::uint64_t nextEpoch = 0;
+        std::vector<std::uint32_t> generations;
+        std::vector<JournalRecord> openByCell;
+    };
+
+    static std::string journalPath(const std::string& basePath, std::uint64_t epoch){
+        return basePath + ".journal-" + std::to_string(epoch);
+    }
+
+    static std::string snapshotPath(const std::string& basePath){
+        return basePath + ".snapshot";
+    }
+
+    TicketJournal(std::string basePath, std::uint64_t epoch,
+        std::chrono::milliseconds commitInterval,
+        std::chrono::milliseconds snapshotInterval,
+        std::function<void()> onSnapshotDue) :
+        basePath(std::move(basePath)),
+        epoch(epoch),
+        fileEpoch(epoch),
+        commitInterval(commitInterval),
+        snapshotInterval(snapshotInterval),
+        onSnapshotDue(std::move(onSnapshotDue)){
+        file = std::fopen(journalPath(this -> basePath, epoch).c_str(), "ab");
+        pending.reserve(GROUP_COMMIT_RECORDS);
+        closing.reserve(GROUP_COMMIT_RECORDS);
+        writing.reserve(GROUP_COMMIT_RECORDS);
+        writingClosing.reserve(GROUP_COMMIT_RECORDS);
+        writer = std::thread(&TicketJournal::writerLoop, this);
+    }
+
+    TicketJournal(const TicketJournal&) = delete;
+    TicketJournal& operator=(const TicketJournal&) = delete;
+
+    ~TicketJournal(){
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            stopping = true;
+        }
+        cv.notify_one();
+        writer.join(); // the writer commits whatever is still pending before it exits
+        if(file != nullptr) syncAndClose(file);
+        if(nextFile != nullptr) std::fclose(nextFile); // prepared but never rotated into, left empty
+    }
+
+    bool isOpen() const{
+        return file != nullptr;
+    }
+
+    void append(const JournalRecord& record){
+        bool batchFull;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            pending.push_back(record);
+            batchFull = pending.size() >= GROUP_COMMIT_RECORDS;
+        }
+        if(batchFull) cv.notify_one();
+    }
+
+    // A rotation is three steps so the shard lock is only held for the cheap middle one:
+    //   prepareRotation()  opens the next journal file. False if it can't, and the snapshot must not go ahead:
+    //                      its epoch would name a journal that already holds events from before it.
+    //   rotate(newEpoch)   under the shard lock, next to the table copy: appends from here on go to the next epoch.
+    //                      Only swaps buffers and bumps the epoch, no I/O.
+    //   commitRotation()   writes and fsyncs what the old file is owed, closes it, moves on (the writer thread does
+    //                      the same on its next commit if it gets there first).
+    // One rotation at a time: callers serialise the three steps.
+    bool prepareRotation(){
+        std::lock_guard<std::mutex> fileGuard(fileMtx);
+        commitPending(); // settles a rotation still in flight, so fileEpoch + 1 is the epoch rotate() will start
+        if(nextFile == nullptr) nextFile = std::fopen(journalPath(basePath, fileEpoch + 1).c_str(), "ab");
+        if(nextFile == nullptr) return false;
+        std::lock_guard<std::mutex> guard(mtx);
+        rotationPrepared = true;
+        return true;
+    }
+
+    bool rotate(std::uint64_t& newEpoch){
+        std::lock_guard<std::mutex> guard(mtx);
+        if(!rotationPrepared) return false;
+        rotationPrepared = false;
+        std::swap(pending, closing); // closing is empty, prepareRotation committed the previous rotation
+        newEpoch = ++epoch;
+        return true;
+    }
+
+    void commitRotation(){
+        std::lock_guard<std::mutex> fileGuard(fileMtx);
+        commitPending();
+    }
+
+    // Written to a temp file and renamed, so a crash mid-snapshot leaves the previous snapshot intact
+    static bool writeSnapshot(const std::string& basePath, std::uint64_t epoch,
+        const std::vector<std::uint32_t>& generations, const std::vector<JournalRecord>& records){
+        std::string tempPath = snapshotPath(basePath) + ".tmp";
+        std::FILE* f = std::fopen(tempPath.c_str(), "wb");
+        if(f == nullptr) return false;
+        SnapshotHeader header;
+        header.epoch = epoch;
+        header.cellCount = generations.size();
+        header.recordCount = records.size();
+        bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+            && std::fwrite(generations.data(), sizeof(std::uint32_t), generations.size(), f) == generations.size()
+            && std::fwrite(records.data(), sizeof(JournalRecord), records.size(), f) == records.size();
+        syncAndClose(f);
+        std::error_code ec;
+        if(ok) std::filesystem::rename(tempPath, snapshotPath(basePath), ec);
+        if(!ok || ec){
+            std::filesystem::remove(tempPath, ec);
+            return false;
+        }
+        // older journals are fully covered by the snapshot now
+        for(std::uint64_t old = epoch; old-- > 0 && std::filesystem::remove(journalPath(basePath, old), ec);){}
+        return true;
+    }
+
+    // Snapshot + every journal from its epoch onwards. cellIndexOf / generationOf decode ticket ids (TicketStore owns the layout)
+    template<typename Store>
+    static RecoveredState recover(const std::string& basePath, const Store& store){
+        RecoveredState state;
+        auto openTicket = [&](const JournalRecord& record){
+            std::uint32_t cellIndex = store.cellIndexOf(record.ticketId);
+            if(cellIndex >= state.openByCell.size()){
+                state.openByCell.resize(cellIndex + 1);
+                state.generations.resize(cellIndex + 1, 1);
+            }
+            state.openByCell[cellIndex] = record;
+            state.generations[cellIndex] = store.generationOf(record.ticketId);
+        };
+        auto closeTicket = [&](const JournalRecord& record){
+            std::uint32_t cellIndex = store.cellIndexOf(record.ticketId);
+            if(cellIndex >= state.openByCell.size() || state.openByCell[cellIndex].ticketId != record.ticketId) return;
+            state.openByCell[cellIndex].ticketId = 0;
+            state.generations[cellIndex] = store.nextGeneration(store.generationOf(record.ticketId));
+        };
+
+        std::FILE* f = std::fopen(snapshotPath(basePath).c_str(), "rb");
+        if(f != nullptr){
+            SnapshotHeader header;
+            if(std::fread(&header, sizeof(header), 1, f) == 1 && header.magic == SNAPSHOT_MAGIC){
+                state.nextEpoch = header.epoch;
+                state.generations.resize(header.cellCount);
+                state.openByCell.resize(header.cellCount);
+                std::vector<JournalRecord> records(header.recordCount);
+                bool ok = std::fread(state.generations.data(), sizeof(std::uint32_t), header.cellCount, f) == header.cellCount
+                    && std::fread(records.data(), sizeof(JournalRecord), records.size(), f) == records.size();
+                if(ok){
+                    for(const JournalRecord& record : records) openTicket(record);
+                }
+                else{
+                    state = RecoveredState{}; // corrupt snapshot, fall back to replaying journals alone
+                }
+            }
+            std::fclose(f);
+        }
+
+        for(std::uint64_t epoch = state.nextEpoch; std::filesystem::exists(journalPath(basePath, epoch)); epoch++){
+            for(const JournalRecord& record : readJournal(journalPath(basePath, epoch))){
+                if(record.eventType == JournalEventType::Park) openTicket(record);
+                else closeTicket(record);
+            }
+            state.nextEpoch = epoch + 1;
+        }
+        return state;
+    }
+};
+
+// -------- Occupancy event bus --------
+
+enum class OccupancyEventType : std::uint8_t{Parked = 1, Unparked = 2};
+
+// What signage/billing/analytics get for every park and unpark. Packed into four words inside the ring.
+struct OccupancyEvent{
+    OccupancyEventType type = OccupancyEventType::Parked;
+    SlotType slotType = SlotType::Small;
+    std::uint16_t shardIndex = 0;
+    std::int32_t slotId = 0;
+    TicketId ticketId = 0;
+    std::int64_t timeTicks = 0; // TimePoint ticks since epoch: entry time for Parked, exit time for Unparked
+    double fee = 0.0;           // Unparked only
+};
+
+// Overwrite: publishers never fail, a consumer that falls a full ring behind skips ahead and counts what it lost.
+// A publisher only waits when it laps a cell whose older writer hasn't finished (see write).
+// DropNewest: nothing is overwritten before every consumer has read it, a publish that would do so is dropped and counted.
+enum class OverflowPolicy{Overwrite, DropNewest};
+
+// Bounded multi-producer ring, every subscriber sees every event through its own cursor (broadcast, not work sharing).
+// Publishing is one fetch_add/CAS on the head plus a seqlock-style write into the cell, no locks and no allocation.
+// Each cursor belongs to one consumer thread; drain copies a batch out and moves the cursor once.
+class OccupancyEventBus{
+public:
+    static constexpr int MAX_CONSUMERS = 16;
+    using ConsumerId = int;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Cell{
+        std::atomic<std::uint64_t> state{0}; // 2*seq+1 while seq is being written, 2*seq+2 once it's readable
+        std::array<std::atomic<std::uint64_t>, 4> words{};
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Cursor{
+        std::atomic<std::uint64_t> position{0};
+        std::atomic<std::uint64_t> lost{0};
+        std::atomic<bool> active{false};
+    };
+
+    const std::uint64_t capacity;
+    const std::uint64_t mask;
+    const OverflowPolicy policy;
+    std::unique_ptr<Cell[]> cells;
+    std::array<Cursor, MAX_CONSUMERS> cursors;
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> head{0};   // next sequence to hand out
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> gating{0}; // DropNewest: cached lower bound of the slowest cursor
+    std::atomic<std::uint64_t> dropped{0};
+    std::atomic<std::uint64_t> overwrittenInFlight{0}; // Overwrite: a stalled publisher found a newer event already in its cell
+    std::mutex subscribeMtx; // subscribe/unsubscribe only, never on the publish or drain path
+
+    static std::uint64_t roundUpToPowerOfTwo(std::uint64_t value){
+        std::uint64_t result = 2;
+        while(result < value) result <<= 1;
+        return result;
+    }
+
+    std::uint64_t slowestCursor(std::uint64_t fallback) const{
+        std::uint64_t slowest = fallback;
+        for(const Cursor& cursor : cursors){
+            if(cursor.active.load(std::memory_order_acquire)) slowest = std::min(slowest, cursor.position.load(std::memory_order_acquire));
+        }
+        return slowest;
+    }
+
+    void write(std::uint64_t sequence, const OccupancyEvent& event){
+        Cell& cell = cells[sequence & mask];
+        const std::uint64_t writing = 2 * sequence + 1;
+        std::uint64_t state = cell.state.load(std::memory_order_relaxed);
+        while(true){
+            if(state >= writing){ // we were lapped between claiming and writing, the newer event wins
+                overwrittenInFlight.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            // An older publisher, a whole ring behind us, is still storing its four words here. The one wait on
+            // the publish path: skipping like the lapped case would leave our sequence unwritten and every
+            // consumer would stop at it. It's bounded by that publisher's remaining stores.
+            if(state & 1){
+                std::this_thread::yield();
+                state = cell.state.load(std::memory_order_relaxed);
+                continue;
+            }
+            if(cell.state.compare_exchange_weak(state, writing, std::memory_order_relaxed)) break;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::uint64_t feeBits;
+        std::memcpy(&feeBits, &event.fee, sizeof(feeBits));
+        cell.words[0].store(static_cast<std::uint64_t>(event.ticketId), std::memory_order_relaxed);
+        cell.words[1].store(static_cast<std::uint64_t>(event.timeTicks), std::memory_order_relaxed);
+        cell.words[2].store(static_cast<std::uint32_t>(event.slotId)
+            | (static_cast<std::uint64_t>(event.shardIndex) << 32)
+            | (static_cast<std::uint64_t>(event.slotType) << 48)
+            | (static_cast<std::uint64_t>(event.type) << 56), std::memory_order_relaxed);
+        cell.words[3].store(feeBits, std::memory_order_relaxed);
+        cell.state.store(writing + 1, std::memory_order_release);
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    explicit OccupancyEventBus(std::size_t capacity, OverflowPolicy policy = OverflowPolicy::Overwrite) :
+        capacity(roundUpToPowerOfTwo(capacity)),
+        mask(this->capacity - 1),
+        policy(policy),
+        cells(std::make_unique<Cell[]>(this->capacity)){}
+
+    OccupancyEventBus(const OccupancyEventBus&) = delete;
+    OccupancyEventBus& operator=(const OccupancyEventBus&) = delete;
+
+    // False only under DropNewest when the slowest consumer is a full ring behind
+    bool publish(const OccupancyEvent& event){
+        std::uint64_t sequence;
+        if(policy == OverflowPolicy::Overwrite){
+            sequence = head.fetch_add(1, std::memory_order_relaxed);
+        }
+        else{
+            sequence = head.load(std::memory_order_relaxed);
+            do{
+                if(sequence - gating.load(std::memory_order_acquire) >= capacity){
+                    std::uint64_t slowest = slowestCursor(sequence);
+                    gating.store(slowest, std::memory_order_release);
+                    if(sequence - slowest >= capacity){
+                        dropped.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                }
+            } while(!head.compare_exchange_weak(sequence, sequence + 1, std::memory_order_relaxed));
+        }
+        write(sequence, event);
+        return true;
+    }
+
+    // New consumers start at the current head, they don't see history. -1 when all MAX_CONSUMERS cursors are taken.
+    ConsumerId subscribe(){
+        std::lock_guard<std::mutex> guard(subscribeMtx);
+        for(int i = 0; i < MAX_CONSUMERS; i++){
+            if(cursors[i].active.load(std::memory_order_relaxed)) continue;
+            cursors[i].position.store(head.load(std::memory_order_acquire), std::memory_order_relaxed);
+            cursors[i].lost.store(0, std::memory_order_relaxed);
+            cursors[i].active.store(true, std::memory_order_release);
+            return i;
+        }
+        return -1;
+    }
+
+    void unsubscribe(ConsumerId consumerId){
+        if(consumerId < 0 || consumerId >= MAX_CONSUMERS) return;
+        std::lock_guard<std::mutex> guard(subscribeMtx);
+        cursors[consumerId].active.store(false, std::memory_order_release);
+    }
+
+    // Copies up to maxEvents into out and returns how many. Stops early at a sequence that is claimed but not yet written.
+    std::size_t drain(ConsumerId consumerId, OccupancyEvent* out, std::size_t maxEvents){
+        if(consumerId < 0 || consumerId >= MAX_CONSUMERS) return 0;
+        Cursor& cursor = cursors[consumerId];
+        std::uint64_t position = cursor.position.load(std::memory_order_relaxed);
+        std::size_t count = 0;
+
+        while(count < maxEvents){
+            Cell& cell = cells[position & mask];
+            const std::uint64_t ready = 2 * position + 2;
+            std::uint64_t before = cell.state.load(std::memory_order_acquire);
+            std::array<std::uint64_t, 4> words;
+            if(before == ready){
+                for(std::size_t i = 0; i < words.size(); i++) words[i] = cell.words[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(cell.state.load(std::memory_order_relaxed) == ready){
+                    OccupancyEvent& event = out[count++];
+                    event.ticketId = static_cast<TicketId>(words[0]);
+                    event.timeTicks = static_cast<std::int64_t>(words[1]);
+                    event.slotId = static_cast<std::int32_t>(words[2] & 0xFFFFFFFFu);
+                    event.shardIndex = static_cast<std::uint16_t>(words[2] >> 32);
+                    event.slotType = static_cast<SlotType>((words[2] >> 48) & 0xFF);
+                    event.type = static_cast<OccupancyEventType>(words[2] >> 56);
+                    std::memcpy(&event.fee, &words[3], sizeof(event.fee));
+                    position++;
+                    continue;
+                }
+                before = cell.state.load(std::memory_order_acquire); // overwritten while we copied it
+            }
+            if(before < ready) break; // our sequence isn't published yet
+
+            // Lapped: everything older than head - capacity is gone, resume at the oldest event still in the ring
+            std::uint64_t oldest = head.load(std::memory_order_acquire) - capacity;
+            std::uint64_t resumeAt = std::max(position + 1, oldest);
+            cursor.lost.fetch_add(resumeAt - position, std::memory_order_relaxed);
+            position = resumeAt;
+        }
+        cursor.position.store(position, std::memory_order_release);
+        return count;
+    }
+
+    std::size_t drain(ConsumerId consumerId, std::vector<OccupancyEvent>& out, std::size_t maxEvents){
+        out.resize(maxEvents);
+        out.resize(drain(consumerId, out.data(), maxEvents));
+        return out.size();
+    }
+
+    // -------- Backpressure / overflow counters --------
+
+    std::uint64_t getCapacity() const{
+        return capacity;
+    }
+
+    // Sequences handed out so far (DropNewest never hands one out for a dropped event)
+    std::uint64_t getPublishedCount() const{
+        return head.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t getDroppedCount() const{
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t getOverwrittenInFlightCount() const{
+        return overwrittenInFlight.load(std::memory_order_relaxed);
+    }
+
+    // Events the consumer skipped because it was lapped (Overwrite only)
+    std::uint64_t getLostCount(ConsumerId consumerId) const{
+        if(consumerId < 0 || consumerId >= MAX_CONSUMERS) return 0;
+        return cursors[consumerId].lost.load(std::memory_order_relaxed);
+    }
+
+    // How far behind the head the consumer is, capacity means publishers are about to overwrite/drop
+    std::uint64_t getBacklog(ConsumerId consumerId) const{
+        if(consumerId < 0 || consumerId >= MAX_CONSUMERS) return 0;
+        std::uint64_t headNow = head.load(std::memory_order_relaxed);
+        std::uint64_t position = cursors[consumerId].position.load(std::memory_order_relaxed);
+        return headNow > position ? headNow - position : 0;
+    }
+};
+
+// -------- Occupancy analytics --------
+
+struct SlotTypeStats{
+    int occupied = 0;
+    int capacity = 0;
+    std::uint64_t parks = 0;   // since the analytics were attached
+    std::uint64_t unparks = 0;
+    double averageDwellMinutes = 0.0;
+};
+
+struct MinuteRollup{
+    std::int64_t minute = 0; // minutes since epoch of the lot clock
+    // [floor * SLOT_TYPE_COUNT + slotTypeIndex]
+    std::vector<std::uint32_t> parks;
+    std::vector<std::uint32_t> unparks;
+    std::vector<std::int64_t> dwellSeconds; // summed over the stays that ended in this minute
+    std::vector<std::int32_t> occupiedAtClose;
+};
+
+struct AnalyticsSnapshot{
+    std::vector<std::array<SlotTypeStats, SLOT_TYPE_COUNT>> floors;
+    std::array<SlotTypeStats, SLOT_TYPE_COUNT> total{};
+    std::vector<MinuteRollup> recentMinutes;                 // closed minutes, oldest first
+    std::array<double, SLOT_TYPE_COUNT> turnoverPerSlotHour{}; // exits per slot per hour over recentMinutes
+};
+
+// Live occupancy/dwell/turnover per floor and SlotType, fed by the shards on every park and unpark.
+// Hot path: a few relaxed-ish fetch_adds on the calling thread's stripe, no lock. Threads map onto STRIPE_COUNT stripes,
+// each stripe's counters live on their own cache lines so gates on different cores don't bounce them.
+// Minute rollups are cut lazily by the first event of a new minute (a try_lock, once a minute) into a circular buffer
+// of retainedMinutes, so memory is floors * SlotTypes * (stripes + retainedMinutes) whatever the history or ticket count.
+// An event racing the cut can land in the neighbouring minute.
+class OccupancyAnalytics{
+    static constexpr int STRIPE_COUNT = 16;
+
+    // One floor's counters within one stripe
+    struct alignas(CACHE_LINE_SIZE) FloorCounters{
+        std::array<std::atomic<std::uint64_t>, SLOT_TYPE_COUNT> parks{};
+        std::array<std::atomic<std::uint64_t>, SLOT_TYPE_COUNT> unparks{};
+        std::array<std::atomic<std::int64_t>, SLOT_TYPE_COUNT> dwellSeconds{};
+    };
+
+    struct Totals{
+        std::vector<std::uint64_t> parks;
+        std::vector<std::uint64_t> unparks;
+        std::vector<std::int64_t> dwellSeconds;
+    };
+
+    const int floorCount;
+    const int cellCount; // floorCount * SLOT_TYPE_COUNT
+    const int retainedMinutes;
+    std::unique_ptr<FloorCounters[]> counters; // [stripe * floorCount + floor]
+    std::unique_ptr<std::atomic<int>[]> capacity; // [cell]
+
+    std::atomic<std::int64_t> currentMinute{-1};
+    std::mutex rollMtx; // guards everything below, taken once a minute by an event and by snapshot()
+    Totals totalsAtLastRoll;
+    std::vector<MinuteRollup> rollups; // circular, rollups[minute % retainedMinutes]
+    std::int64_t oldestRetainedMinute = 0;
+    std::int64_t rolledMinutes = 0;
+
+    static int stripeOfThisThread(){
+        static std::atomic<int> nextStripe{0};
+        thread_local int stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % STRIPE_COUNT;
+        return stripe;
+    }
+
+    FloorCounters& countersFor(int floor){
+        return counters[stripeOfThisThread() * floorCount + floor];
+    }
+
+    static std::int64_t minuteOf(TimePoint time){
+        return std::chrono::duration_cast<std::chrono::minutes>(time.time_since_epoch()).count();
+    }
+
+    std::uint64_t sumParks(int floor, int type) const{
+        std::uint64_t parks = 0;
+        for(int stripe = 0; stripe < STRIPE_COUNT; stripe++){
+            parks += counters[stripe * floorCount + floor].parks[type].load(std::memory_order_acquire);
+        }
+        return parks;
+    }
+
+    // Per cell: parks, then unparks (and dwell), then parks again, retried until the two park reads agree.
+    // An unpark always follows its park under the shard lock, so with parks unchanged around the unpark read the cell's
+    // occupancy lies between its values at the start and end of the read: never negative, never above capacity.
+    // Under relentless churn a cell gives up after MAX_READ_ATTEMPTS and keeps the last read, whose occupancy is then
+    // an upper bound (a re-park between the reads counts while its earlier exit does too).
+    Totals readTotals() const{
+        static constexpr int MAX_READ_ATTEMPTS = 16;
+        Totals totals{std::vector<std::uint64_t>(cellCount), std::vector<std::uint64_t>(cellCount), std::vector<std::int64_t>(cellCount)};
+        for(int floor = 0; floor < floorCount; floor++){
+            for(int type = 0; type < SLOT_TYPE_COUNT; type++){
+                const int cell = floor * SLOT_TYPE_COUNT + type;
+                std::uint64_t parksBefore = sumParks(floor, type);
+                for(int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++){
+                    std::uint64_t unparks = 0;
+                    std::int64_t dwellSeconds = 0;
+                    for(int stripe = 0; stripe < STRIPE_COUNT; stripe++){
+                        const FloorCounters& block = counters[stripe * floorCount + floor];
+                        unparks += block.unparks[type].load(std::memory_order_acquire);
+                        dwellSeconds += block.dwellSeconds[type].load(std::memory_order_acquire);
+                    }
+                    std::uint64_t parksAfter = sumParks(floor, type);
+                    totals.parks[cell] = parksAfter;
+                    totals.unparks[cell] = unparks;
+                    totals.dwellSeconds[cell] = dwellSeconds;
+                    if(parksAfter == parksBefore) break;
+                    parksBefore = parksAfter;
+                }
+            }
+        }
+        return totals;
+    }
+
+    // Called under rollMtx: closes every minute before upToMinute
+    void rollTo(std::int64_t upToMinute){
+        std::int64_t minute = currentMinute.load(std::memory_order_acquire);
+        if(minute == -1 || upToMinute <= minute){
+            if(minute == -1) currentMinute.store(upToMinute, std::memory_order_release);
+            return;
+        }
+        Totals totals = readTotals();
+        // after a long idle gap only the last retainedMinutes are worth writing, the rest would be overwritten anyway
+        std::int64_t firstToWrite = std::max(minute, upToMinute - retainedMinutes);
+        for(std::int64_t closing = firstToWrite; closing < upToMinute; closing++){
+            MinuteRollup& rollup = rollups[static_cast<std::size_t>(closing % retainedMinutes)];
+            rollup.minute = closing;
+            for(int cell = 0; cell < cellCount; cell++){
+                bool hasEvents = closing == minute; // everything since the last cut belongs to the minute that was open
+                rollup.parks[cell] = hasEvents ? static_cast<std::uint32_t>(totals.parks[cell] - totalsAtLastRoll.parks[cell]) : 0;
+                rollup.unparks[cell] = hasEvents ? static_cast<std::uint32_t>(totals.unparks[cell] - totalsAtLastRoll.unparks[cell]) : 0;
+                rollup.dwellSeconds[cell] = hasEvents ? totals.dwellSeconds[cell] - totalsAtLastRoll.dwellSeconds[cell] : 0;
+                rollup.occupiedAtClose[cell] = static_cast<std::int32_t>(totals.parks[cell] - totals.unparks[cell]);
+            }
+        }
+        rolledMinutes += upToMinute - firstToWrite;
+        oldestRetainedMinute = upToMinute - std::min<std::int64_t>(rolledMinutes, retainedMinutes);
+        totalsAtLastRoll = std::move(totals);
+        currentMinute.store(upToMinute, std::memory_order_release);
+    }
+
+    void maybeRoll(TimePoint time){
+        std::int64_t minute = minuteOf(time);
+        if(minute <= currentMinute.load(std::memory_order_relaxed)) return;
+        std::unique_lock<std::mutex> lock(rollMtx, std::try_to_lock);
+        if(lock.owns_lock()) rollTo(minute); // somebody else is already cutting this minute
+    }
+
+public:
+    // retainedMinutes bounds the rollup history (default one hour)
+    explicit OccupancyAnalytics(int floorCount, int retainedMinutes = 60) :
+        floorCount(std::max(1, floorCount)),
+        cellCount(this->floorCount * SLOT_TYPE_COUNT),
+        retainedMinutes(std::max(1, retainedMinutes)),
+        counters(std::make_unique<FloorCounters[]>(STRIPE_COUNT * this->floorCount)),
+        capacity(std::make_unique<std::atomic<int>[]>(cellCount)),
+        totalsAtLastRoll{std::vector<std::uint64_t>(cellCount), std::vector<std::uint64_t>(cellCount), std::vector<std::int64_t>(cellCount)},
+        rollups(this->retainedMinutes){
+        for(MinuteRollup& rollup : rollups){
+            rollup.parks.resize(cellCount);
+            rollup.unparks.resize(cellCount);
+            rollup.dwellSeconds.resize(cellCount);
+            rollup.occupiedAtClose.resize(cellCount);
+        }
+    }
+
+    OccupancyAnalytics(const OccupancyAnalytics&) = delete;
+    OccupancyAnalytics& operator=(const OccupancyAnalytics&) = delete;
+
+    int getFloorCount() const{
+        return floorCount;
+    }
+
+    void setCapacity(int floor, SlotType slotType, int slots){
+        if(floor < 0 || floor >= floorCount) return;
+        capacity[floor * SLOT_TYPE_COUNT + slotTypeIndex(slotType)].store(slots, std::memory_order_relaxed);
+    }
+
+    void recordPark(int floor, SlotType slotType, TimePoint entryTime){
+        if(floor < 0 || floor >= floorCount) return;
+        maybeRoll(entryTime);
+        countersFor(floor).parks[slotTypeIndex(slotType)].fetch_add(1, std::memory_order_release);
+    }
+
+    void recordUnpark(int floor, SlotType slotType, TimePoint entryTime, TimePoint exitTime){
+        if(floor < 0 || floor >= floorCount) return;
+        maybeRoll(exitTime);
+        FloorCounters& block = countersFor(floor);
+        std::int64_t dwell = std::chrono::duration_cast<std::chrono::seconds>(exitTime - entryTime).count();
+        block.dwellSeconds[slotTypeIndex(slotType)].fetch_add(std::max<std::int64_t>(0, dwell), std::memory_order_release);
+        block.unparks[slotTypeIndex(slotType)].fetch_add(1, std::memory_order_release);
+    }
+
+    // Live totals plus the closed minutes. Recorders keep running while this reads; it only waits for a minute cut in progress.
+    AnalyticsSnapshot snapshot(){
+        AnalyticsSnapshot result;
+        result.floors.resize(floorCount);
+        std::lock_guard<std::mutex> guard(rollMtx);
+        Totals totals = readTotals();
+        std::array<std::uint64_t, SLOT_TYPE_COUNT> recentUnparks{};
+        for(std::int64_t minute = oldestRetainedMinute; rolledMinutes > 0 && minute < currentMinute.load(std::memory_order_relaxed); minute++){
+            const MinuteRollup& rollup = rollups[static_cast<std::size_t>(minute % retainedMinutes)];
+            for(int cell = 0; cell < cellCount; cell++) recentUnparks[cell % SLOT_TYPE_COUNT] += rollup.unparks[cell];
+            result.recentMinutes.push_back(rollup);
+        }
+
+        std::array<std::int64_t, SLOT_TYPE_COUNT> dwellSeconds{};
+        for(int floor = 0; floor < floorCount; floor++){
+            for(int type = 0; type < SLOT_TYPE_COUNT; type++){
+                int cell = floor * SLOT_TYPE_COUNT + type;
+                SlotTypeStats& stats = result.floors[floor][type];
+                stats.parks = totals.parks[cell];
+                stats.unparks = totals.unparks[cell];
+                stats.occupied = static_cast<int>(stats.parks - stats.unparks);
+                stats.capacity = capacity[cell].load(std::memory_order_relaxed);
+                stats.averageDwellMinutes = stats.unparks == 0 ? 0.0 : totals.dwellSeconds[cell] / 60.0 / stats.unparks;
+
+                SlotTypeStats& total = result.total[type];
+                total.parks += stats.parks;
+                total.unparks += stats.unparks;
+                total.occupied += stats.occupied;
+                total.capacity += stats.capacity;
+                dwellSeconds[type] += totals.dwellSeconds[cell];
+            }
+        }
+        double hours = result.recentMinutes.size() / 60.0;
+        for(int type = 0; type < SLOT_TYPE_COUNT; type++){
+            SlotTypeStats& total = result.total[type];
+            total.averageDwellMinutes = total.unparks == 0 ? 0.0 : dwellSeconds[type] / 60.0 / total.unparks;
+            if(total.capacity > 0 && hours > 0.0) result.turnoverPerSlotHour[type] = recentUnparks[type] / (total.capacity * hours);
+        }
+        return result;
+    }
+};
+
+// One floor/zone: its own SlotManager and ticket table behind its own lock, so shards never contend with each other.
+// Ticket ids carry the shard index in their low shardBits bits, which lets the owner route an unpark without any lookup.
+// ParkingLotSystem is simply a single shard with shardBits = 0.
+class alignas(CACHE_LINE_SIZE) ParkingShard{
+    const int shardIndex;
+    std::unique_ptr<SlotManager> slotManager;
+    TicketStore activeTickets; // ticket ids come from the store, they encode the slab cell and the shard
+    VehicleNumberIndex& vehicleNumberIndex; // owned by the lot, shared across its shards
+    ReservationTimer& reservationTimer;     // owned by the lot, fires expireReservation on its own thread
+    ReservationBook reservations;
+    std::mutex reservationMtx; // separate from mtx so holds and expiries never block plain park/unpark; taken before mtx
+    std::shared_ptr<const Tariff> tariff = Tariff::defaultTariff(); // swapped under mtx, read under mtx in unpark
+    std::shared_ptr<const IClock> clock = SystemClock::instance();  // same, read under mtx in park/unpark
+    std::size_t slotCount = 0;
+    std::array<int, SLOT_TYPE_COUNT> slotCountByType{}; // under mtx
+    std::string journalBasePath;
+    std::atomic<OccupancyEventBus*> eventBus{nullptr}; // not owned, must outlive the shard or be detached first
+    std::atomic<OccupancyAnalytics*> analytics{nullptr}; // same; the shard index is the floor
+    mutable std::mutex mtx;
+    std::mutex snapshotMtx; // one snapshot at a time (startup and the journal's writer thread), taken before mtx
+    std::unique_ptr<TicketJournal> journal; // declared last: destroyed first, so its writer thread never sees a half-destroyed shard
+
+    // Called under mtx
+    void publishEvent(OccupancyEventType type, TicketId ticketId, int slotId, SlotType slotType, TimePoint time, double fee){
+        OccupancyEventBus* bus = eventBus.load(std::memory_order_acquire);
+        if(bus == nullptr) return;
+        OccupancyEvent event;
+        event.type = type;
+        event.slotType = slotType;
+        event.shardIndex = static_cast<std::uint16_t>(shardIndex);
+        event.slotId = slotId;
+        event.ticketId = ticketId;
+        event.timeTicks = time.time_since_epoch().count();
+        event.fee = fee;
+        bus -> publish(event);
+    }
+
+    // Called under mtx
+    void recordPark(SlotType slotType, TimePoint entryTime){
+        if(OccupancyAnalytics* floorAnalytics = analytics.load(std::memory_order_acquire)) floorAnalytics -> recordPark(shardIndex, slotType, entryTime);
+    }
+
+public:
+    ParkingShard(int shardIndex, int shardBits, VehicleNumberIndex& vehicleNumberIndex, ReservationTimer& reservationTimer) :
+        shardIndex(shardIndex),
+        slotManager(std::make_unique<SlotManager>()),
+        activeTickets(shardIndex, shardBits),
+        vehicleNumberIndex(vehicleNumberIndex),
+        reservationTimer(reservationTimer),
+        reservations(shardIndex, shardBits){}
+
+    ParkingShard(const ParkingShard&) = delete;
+    ParkingShard& operator=(const ParkingShard&) = delete;
+
+    int getShardIndex() const{
+        return shardIndex;
+    }
+
+    void addParkingSlot(SlotType slotType, SlotLocation location = {}){
+        std::lock_guard<std::mutex> guard(mtx);
+        slotManager -> addParkingSlot(slotType, location);
+        activeTickets.reserve(++slotCount);
+        vehicleNumberIndex.addCapacity(1);
+        int typeCount = ++slotCountByType[slotTypeIndex(slotType)];
+        if(OccupancyAnalytics* floorAnalytics = analytics.load(std::memory_order_acquire)) floorAnalytics -> setCapacity(shardIndex, slotType, typeCount);
+    }
+
+    void setSlotSelectionStrategy(std::unique_ptr<ISlotSelectionStrategy> strategy){
+        slotManager -> updateStartegy(std::move(strategy));
+    }
+
+    void setTariff(std::shared_ptr<const Tariff> newTariff){
+        std::lock_guard<std::mutex> guard(mtx);
+        tariff = std::move(newTariff);
+    }
+
+    void setClock(std::shared_ptr<const IClock> newClock){
+        std::lock_guard<std::mutex> guard(mtx);
+        clock = std::move(newClock);
+    }
+
+    // Under mtx like every publish, so once this returns no gate is still inside the old bus and it can be destroyed
+    void setEventBus(OccupancyEventBus* bus){
+        std::lock_guard<std::mutex> guard(mtx);
+        eventBus.store(bus, std::memory_order_release);
+    }
+
+    // Counts start from zero when attached, attach before the shard takes traffic
+    void setAnalytics(OccupancyAnalytics* newAnalytics){
+        std::lock_guard<std::mutex> guard(mtx);
+        analytics.store(newAnalytics, std::memory_order_release);
+        if(newAnalytics == nullptr) return;
+        for(SlotType slotType : ALL_SLOT_TYPES) newAnalytics -> setCapacity(shardIndex, slotType, slotCountByType[slotTypeIndex(slotType)]);
+    }
+
+    int getFreeCount(SlotType slotType) const{
+        return slotManager -> getFreeCount(slotType);
+    }
+
+    // -1 when no compatible slot is free, the plate is already parked or it is longer than VehicleNumber::MAX_LENGTH
+    TicketId parkVehicle(std::string_view vehicleNumber, VehicleType vehicleType, int gateId = 0){
+        // Step 0: claim the plate first so a duplicate park is rejected before it takes a slot
+        if(!vehicleNumberIndex.tryClaim(vehicleNumber)) return -1;
+
+         // Step 1: allocate slot (SlotManager handles its own locking)
+        auto allocated = slotManager->allocateSlot(vehicleType, gateId);
+        if (!allocated.has_value()) {
+            vehicleNumberIndex.releaseClaim(vehicleNumber);
+            return -1;
+        }
+
+        // Step 2: create ticket under the shard lock
+        TicketId ticketId;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            TimePoint entryTime = clock -> now();
+            ticketId = activeTickets.emplace(
+                vehicleNumber,
+                allocated->first,   // slotId
+                allocated->second,  // slotType
+                entryTime
+            );
+            // appended under the shard lock so journal order matches ticket table order
+            if(ticketId != -1 && journal) journal -> append(JournalRecord::fromTicket(JournalEventType::Park, *activeTickets.find(ticketId)));
+            // published under it too, so a ticket's Unparked can never overtake its Parked
+            if(ticketId != -1){
+                publishEvent(OccupancyEventType::Parked, ticketId, allocated->first, allocated->second, entryTime, 0.0);
+                recordPark(allocated->second, entryTime);
+            }
+        }
+        if(ticketId == -1){
+            slotManager -> releaseSlot(allocated->first); // slab full, don't leak the slot
+            vehicleNumberIndex.releaseClaim(vehicleNumber);
+            return -1;
+        }
+        vehicleNumberIndex.assign(vehicleNumber, ticketId);
+        return ticketId;
+    }
+
+    double unparkVehicle(TicketId ticketId){
+
+        std::lock_guard<std::mutex> guard(mtx); // required because If a data structure is protected by a mutex in one method, it must be protected in all methods that read/write it.
+        // also Two threads could call unparkVehicle(ticketId) at the same time; only one of them gets the ticket out of the store
+
+        std::optional<Ticket> closingTicket = activeTickets.release(ticketId); // nullopt for unknown, stale or already closed ids
+        if(closingTicket.has_value()){
+            if(journal) journal -> append(JournalRecord::fromTicket(JournalEventType::Unpark, closingTicket.value()));
+
+            // Slot can be release immediately and biling is independent and hence can be done afterwards
+            int slotID = closingTicket -> getSlotId();
+            slotManager -> releaseSlot(slotID);
+            vehicleNumberIndex.erase(closingTicket -> getVehicleNumber(), ticketId);
+
+            TimePoint exitTime = clock -> now();
+            closingTicket -> closeTicket(exitTime);
+
+            double fee = tariff -> priceTicket(closingTicket.value()); // priced by SlotType, time of day, cap and grace
+            publishEvent(OccupancyEventType::Unparked, ticketId, slotID, closingTicket -> getSlotType(), exitTime, fee);
+            if(OccupancyAnalytics* floorAnalytics = analytics.load(std::memory_order_acquire)){
+                floorAnalytics -> recordUnpark(shardIndex, closingTicket -> getSlotType(), closingTicket -> getEntryTime(), exitTime);
+            }
+            return fee;
+        }
+        else return 0.0;
+    }
+
+    // -------- Reservations --------
+    // Holds are in-memory only, the journal doesn't cover them, so a restart drops every pending hold.
+
+    // Holds a slot of exactly slotType for the plate until deadline. -1 when the plate is already parked/held (or too long)
+    // or no slot is free.
+    ReservationId reserveSlot(std::string_view vehicleNumber, SlotType slotType, TimePoint deadline){
+        if(!vehicleNumberIndex.tryClaim(vehicleNumber)) return -1;
+        std::optional<int> slotId = slotManager -> holdSlot(slotType);
+        if(!slotId.has_value()){
+            vehicleNumberIndex.releaseClaim(vehicleNumber);
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> guard(reservationMtx);
+        Reservation reservation;
+        reservation.vehicleNumber = VehicleNumber(vehicleNumber);
+        reservation.slotId = slotId.value();
+        reservation.slotType = slotType;
+        reservation.deadline = deadline;
+        ReservationId reservationId = reservations.emplace(reservation);
+        if(reservationId == -1){
+            slotManager -> releaseSlot(slotId.value());
+            vehicleNumberIndex.releaseClaim(vehicleNumber);
+            return -1;
+        }
+        reservations.setTimer(reservationId, reservationTimer.schedule(reservationId, deadline));
+        return reservationId;
+    }
+
+    // Car arrived: the held slot becomes a ticket, no allocation. -1 when the hold already lapsed or was cancelled.
+    TicketId claimReservation(ReservationId reservationId){
+        std::optional<Reservation> reservation;
+        {
+            std::lock_guard<std::mutex> guard(reservationMtx);
+            reservation = reservations.release(reservationId);
+            if(!reservation.has_value()) return -1;
+            reservationTimer.cancel(reservation -> timer);
+        }
+
+        std::string_view vehicleNumber = reservation -> vehicleNumber.view();
+        TicketId ticketId;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            TimePoint entryTime = clock -> now();
+            ticketId = activeTickets.emplace(vehicleNumber, reservation -> slotId, reservation -> slotType, entryTime);
+            if(ticketId != -1 && journal) journal -> append(JournalRecord::fromTicket(JournalEventType::Park, *activeTickets.find(ticketId)));
+            if(ticketId != -1){
+                publishEvent(OccupancyEventType::Parked, ticketId, reservation -> slotId, reservation -> slotType, entryTime, 0.0);
+                recordPark(reservation -> slotType, entryTime);
+            }
+        }
+        if(ticketId == -1){
+            slotManager -> releaseSlot(reservation -> slotId);
+            vehicleNumberIndex.releaseClaim(vehicleNumber);
+            return -1;
+        }
+        vehicleNumberIndex.assign(vehicleNumber, ticketId);
+        return ticketId;
+    }
+
+    // Explicit cancel and timer expiry both land here, whichever comes first wins
+    bool cancelReservation(ReservationId reservationId){
+        std::optional<Reservation> reservation;
+        {
+            std::lock_guard<std::mutex> guard(reservationMtx);
+            reservation = reservations.release(reservationId);
+            if(!reservation.has_value()) return false;
+            reservationTimer.cancel(reservation -> timer); // no-op when called from the expiry itself
+        }
+        slotManager -> releaseSlot(reservation -> slotId);
+        vehicleNumberIndex.releaseClaim(reservation -> vehicleNumber.view());
+        return true;
+    }
+
+    int getHeldCount(){
+        std::lock_guard<std::mutex> guard(reservationMtx);
+        return static_cast<int>(reservations.size());
+    }
+
+    // -------- Journal / crash recovery --------
+
+    // Call once at startup, after the shard's slots have been added and before it takes traffic.
+    // Rebuilds occupancy, the ticket table and the plate index from <directory>/shard-<i>.snapshot + journals,
+    // writes a fresh snapshot and then journals every park/unpark. Returns the number of recovered open tickets,
+    // -1 when the journal file can't be opened: the recovered state is kept but nothing will be journaled.
+    int openJournal(const std::string& directory, std::chrono::milliseconds snapshotInterval){
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        journalBasePath = directory + "/shard-" + std::to_string(shardIndex);
+
+        int recovered = 0;
+        std::uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            if(journal) return 0;
+            TicketJournal::RecoveredState state = TicketJournal::recover(journalBasePath, activeTickets);
+            for(std::uint32_t cellIndex = 0; cellIndex < state.generations.size(); cellIndex++){
+                activeTickets.restoreCell(cellIndex, state.generations[cellIndex]);
+            }
+            for(const JournalRecord& record : state.openByCell){
+                if(record.ticketId == 0) continue;
+                Ticket ticket = record.toTicket();
+                // a slot that no longer exists (lot reconfigured) drops its ticket rather than corrupting occupancy
+                if(!slotManager -> occupySlot(ticket.getSlotId())) continue;
+                activeTickets.restoreTicket(ticket);
+                vehicleNumberIndex.tryClaim(ticket.getVehicleNumber());
+                vehicleNumberIndex.assign(ticket.getVehicleNumber(), ticket.getTicketId());
+                recovered++;
+            }
+            activeTickets.rebuildFreeList();
+            epoch = state.nextEpoch;
+            auto newJournal = std::make_unique<TicketJournal>(journalBasePath, epoch,
+                std::chrono::milliseconds(5), snapshotInterval, [this](){ writeSnapshot(); });
+            if(!newJournal -> isOpen()) return -1;
+            journal = std::move(newJournal);
+        }
+        writeSnapshot();
+        return recovered;
+    }
+
+    // Copies the table and flips the journal epoch under the lock (the only pause gates see, no I/O in it),
+    // then commits the old journal file and writes the snapshot without holding anything gates need
+    bool writeSnapshot(){
+        std::lock_guard<std::mutex> snapshotGuard(snapshotMtx);
+        TicketJournal* shardJournal;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            shardJournal = journal.get();
+        }
+        if(shardJournal == nullptr || !shardJournal -> prepareRotation()) return false;
+
+        std::vector<std::uint32_t> generations;
+        std::vector<JournalRecord> records;
+        std::uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            generations = activeTickets.getGenerations();
+            records.reserve(activeTickets.size());
+            activeTickets.forEachTicket([&records](const Ticket& ticket){
+                records.push_back(JournalRecord::fromTicket(JournalEventType::Park, ticket));
+            });
+            if(!shardJournal -> rotate(epoch)) return false;
+        }
+        shardJournal -> commitRotation();
+        return TicketJournal::writeSnapshot(journalBasePath, epoch, generations, records);
+    }
+};
+
+class ParkingLotSystem{
+    VehicleNumberIndex vehicleNumberIndex; // declared before shard, the shard keeps a reference to it
+    // Declared before shard, which keeps a reference to it. Expiries call back into the shard, so the destructor stops
+    // the timer before the shard goes away.
+    ReservationTimer reservationTimer{std::chrono::seconds(1), [this](ReservationId reservationId){ shard.cancelReservation(reservationId); }};
+    ParkingShard shard{0, 0, vehicleNumberIndex, reservationTimer};
+
+    ParkingLotSystem() = default;
+
+public:
+    ParkingLotSystem(const ParkingLotSystem&) = delete;
+    ParkingLotSystem& operator=(const ParkingLotSystem&) = delete;
+
+    ~ParkingLotSystem(){
+        reservationTimer.stop();
+    }
+
+    static ParkingLotSystem& getInstance(){
+        static ParkingLotSystem instance;
+        return instance;
+    }
+
+    void addParkingSlot(SlotType slotType, SlotLocation location = {}){
+        shard.addParkingSlot(slotType, location);
+    }
+
+    void setSlotSelectionStrategy(std::unique_ptr<ISlotSelectionStrategy> strategy){
+        shard.setSlotSelectionStrategy(std::move(strategy));
+    }
+
+    void setTariff(std::shared_ptr<const Tariff> tariff){
+        shard.setTariff(std::move(tariff));
+    }
+
+    // Stamps tickets and drives reservation expiry
+    void setClock(std::shared_ptr<const IClock> clock){
+        reservationTimer.setClock(clock);
+        shard.setClock(std::move(clock));
+    }
+
+    // nullptr detaches. The bus is not owned and must outlive the attachment.
+    void setEventBus(OccupancyEventBus* bus){
+        shard.setEventBus(bus);
+    }
+
+    // Single floor: analytics built with floorCount 1. Not owned.
+    void setAnalytics(OccupancyAnalytics* analytics){
+        shard.setAnalytics(analytics);
+    }
+
+    int getFreeCount(SlotType slotType) const{
+        return shard.getFreeCount(slotType);
+    }
+
+    TicketId parkVehicle(std::string_view vehicleNumber, VehicleType vehicleType, int gateId = 0){
+        return shard.parkVehicle(vehicleNumber, vehicleType, gateId);
+    }
+
+    double unparkVehicle(TicketId ticketId){
+        return shard.unparkVehicle(ticketId);
+    }
+
+    std::optional<TicketId> findTicketByVehicleNumber(std::string_view vehicleNumber) const{
+        return vehicleNumberIndex.findTicket(vehicleNumber);
+    }
+
+    // See ParkingShard::openJournal, returns the number of open tickets recovered or -1
+    int openJournal(const std::string& directory, std::chrono::milliseconds snapshotInterval = std::chrono::seconds(60)){
+        return shard.openJournal(directory, snapshotInterval);
+    }
+
+    ReservationId reserveSlot(std::string_view vehicleNumber, SlotType slotType, TimePoint arrivalDeadline){
+        return shard.reserveSlot(vehicleNumber, slotType, arrivalDeadline);
+    }
+
+    TicketId claimReservation(ReservationId reservationId){
+        return shard.claimReservation(reservationId);
+    }
+
+    bool cancelReservation(ReservationId reservationId){
+        return shard.cancelReservation(reservationId);
+    }
+
+    int getHeldCount(){
+        return shard.getHeldCount();
+    }
+};
+
+// Sharded deployment for multi-floor / multi-site lots: N independent ParkingShards.
+// Not a singleton on purpose, every site owns one instance.
+// Park tries the preferred shard first and then fans out to its neighbours (+1, -1, +2, -2...) when it is full.
+// Unpark decodes the shard from the ticket id and only ever touches that shard's lock.
+class ShardedParkingLotSystem{
+    static constexpr int MAX_SHARD_BITS = 8; // up to 256 shards, TicketStore sizes its generation bits around this
+
+    VehicleNumberIndex vehicleNumberIndex; // one index for the whole lot so a plate can't be parked on two floors
+    std::vector<std::unique_ptr<ParkingShard>> shards;
+    int shardBits = 0;
+    // One wheel for every shard, expiries are routed by the shard bits of the reservation id.
+    // Declared after shards so its thread is joined before they go away.
+    ReservationTimer reservationTimer;
+
+public:
+    // reservationTick is the expiry resolution, holds lapse at most one tick after their deadline
+    explicit ShardedParkingLotSystem(int shardCount, std::chrono::milliseconds reservationTick = std::chrono::seconds(1)) :
+        reservationTimer(reservationTick, [this](ReservationId reservationId){ cancelReservation(reservationId); }){
+        shardCount = std::max(1, std::min(shardCount, 1 << MAX_SHARD_BITS));
+        while((1 << shardBits) < shardCount) shardBits++;
+        for(int i = 0; i < shardCount; i++){
+            shards.push_back(std::make_unique<ParkingShard>(i, shardBits, vehicleNumberIndex, reservationTimer));
+        }
+    }
+
+    int getShardCount() const{
+        return static_cast<int>(shards.size());
+    }
+
+    int getShardOfTicket(TicketId ticketId) const{
+        return static_cast<int>(ticketId & ((TicketId{1} << shardBits) - 1));
+    }
+
+    void addParkingSlot(int shardIndex, SlotType slotType, SlotLocation location = {}){
+        if(shardIndex < 0 || shardIndex >= getShardCount()) return;
+        shards[shardIndex] -> addParkingSlot(slotType, location);
+    }
+
+    void setSlotSelectionStrategy(int shardIndex, std::unique_ptr<ISlotSelectionStrategy> strategy){
+        if(shardIndex < 0 || shardIndex >= getShardCount()) return;
+        shards[shardIndex] -> setSlotSelectionStrategy(std::move(strategy));
+    }
+
+    // One tariff for the whole site
+    void setTariff(const std::shared_ptr<const Tariff>& tariff){
+        for(auto& shard : shards) shard -> setTariff(tariff);
+    }
+
+    // Stamps tickets and drives reservation expiry
+    void setClock(const std::shared_ptr<const IClock>& clock){
+        reservationTimer.setClock(clock);
+        for(auto& shard : shards) shard -> setClock(clock);
+    }
+
+    // Every shard publishes into the same bus, events carry their shard index
+    void setEventBus(OccupancyEventBus* bus){
+        for(auto& shard : shards) shard -> setEventBus(bus);
+    }
+
+    // One floor per shard, build the analytics with floorCount >= getShardCount(). Not owned.
+    void setAnalytics(OccupancyAnalytics* analytics){
+        for(auto& shard : shards) shard -> setAnalytics(analytics);
+    }
+
+    int getFreeCount(SlotType slotType) const{
+        int freeCount = 0;
+        for(const auto& shard : shards) freeCount += shard -> getFreeCount(slotType);
+        return freeCount;
+    }
+
+    int getFreeCount(int shardIndex, SlotType slotType) const{
+        if(shardIndex < 0 || shardIndex >= getShardCount()) return 0;
+        return shards[shardIndex] -> getFreeCount(slotType);
+    }
+
+    TicketId parkVehicle(std::string_view vehicleNumber, VehicleType vehicleType, int preferredShard, int gateId = 0){
+        if(vehicleNumberIndex.findTicket(vehicleNumber).has_value()) return -1; // don't fan out a duplicate to every floor
+        int shardCount = getShardCount();
+        preferredShard = ((preferredShard % shardCount) + shardCount) % shardCount;
+        for(int distance = 0; distance < shardCount; distance++){
+            // distance 0 -> preferred, then alternate up and down the floors
+            int offset = (distance + 1) / 2;
+            int shardIndex = (distance % 2 == 1) ? preferredShard + offset : preferredShard - offset;
+            shardIndex = ((shardIndex % shardCount) + shardCount) % shardCount;
+            TicketId ticketId = shards[shardIndex] -> parkVehicle(vehicleNumber, vehicleType, gateId);
+            if(ticketId != -1) return ticketId;
+        }
+        return -1;
+    }
+
+    double unparkVehicle(TicketId ticketId){
+        if(ticketId <= 0) return 0.0;
+        int shardIndex = getShardOfTicket(ticketId);
+        if(shardIndex >= getShardCount()) return 0.0;
+        return shards[shardIndex] -> unparkVehicle(ticketId);
+    }
+
+    // Holds are per floor, there is no fan-out: the caller picks the floor the booking is for
+    ReservationId reserveSlot(int shardIndex, std::string_view vehicleNumber, SlotType slotType, TimePoint arrivalDeadline){
+        if(shardIndex < 0 || shardIndex >= getShardCount()) return -1;
+        return shards[shardIndex] -> reserveSlot(vehicleNumber, slotType, arrivalDeadline);
+    }
+
+    TicketId claimReservation(ReservationId reservationId){
+        if(reservationId <= 0 || getShardOfTicket(reservationId) >= getShardCount()) return -1;
+        return shards[getShardOfTicket(reservationId)] -> claimReservation(reservationId);
+    }
+
+    bool cancelReservation(ReservationId reservationId){
+        if(reservationId <= 0 || getShardOfTicket(reservationId) >= getShardCount()) return false;
+        return shards[getShardOfTicket(reservationId)] -> cancelReservation(reservationId);
+    }
+
+    int getHeldCount(int shardIndex){
+        if(shardIndex < 0 || shardIndex >= getShardCount()) return 0;
+        return shards[shardIndex] -> getHeldCount();
+    }
+
+    // Every shard journals to its own files (and writer thread) in directory. -1 if any shard's journal didn't open.
+    int openJournal(const std::string& directory, std::chrono::milliseconds snapshotInterval = std::chrono::seconds(60)){
+        int recovered = 0;
+        bool allOpen = true;
+        for(auto& shard : shards){
+            int shardRecovered = shard -> openJournal(directory, snapshotInterval);
+            if(shardRecovered < 0) allOpen = false;
+            else recovered += shardRecovered;
+        }
+        return allOpen ? recovered : -1;
+    }
+
+    std::optional<TicketId> findTicketByVehicleNumber(std::string_view vehicleNumber) const{
+        return vehicleNumberIndex.findTicket(vehicleNumber);
+    }
+};
+
+// Random allocate/occupy/release through SlotManager against a model of which slots are held. Every allocation must
+// be a free, compatible slot that isn't already handed out, it may only fail when no compatible slot is free, and
+// after every step the free counts per SlotType must equal capacity minus held. Also pokes FreeSlotIndex directly
+// for the double add/remove guards. False on any violation.
+bool runFreeSlotIndexCheck(){
+    const int slotCount = 90;
+    const int operations = 200000;
+    SlotManager slotManager;
+    std::vector<SlotType> slotTypes(slotCount + 1);
+    std::array<int, SLOT_TYPE_COUNT> capacity{};
+    std::mt19937 rng(42);
+    for(int slotId = 1; slotId <= slotCount; slotId++){
+        slotTypes[slotId] = ALL_SLOT_TYPES[rng() % SLOT_TYPE_COUNT];
+        capacity[slotTypeIndex(slotTypes[slotId])]++;
+        slotManager.addParkingSlot(slotTypes[slotId]);
+    }
+
+    std::vector<bool> held(slotCount + 1, false);
+    std::vector<int> heldSlots;
+    std::array<int, SLOT_TYPE_COUNT> heldByType{};
+    int violations = 0;
+    for(int i = 0; i < operations; i++){
+        unsigned step = rng() % 10;
+        if(step == 0){ // a specific slot, as journal recovery does, pulls it from the middle of its bucket
+            int slotId = 1 + static_cast<int>(rng() % slotCount);
+            if(slotManager.occupySlot(slotId) == held[slotId]) violations++;
+            if(!held[slotId]){
+                held[slotId] = true;
+                heldSlots.push_back(slotId);
+                heldByType[slotTypeIndex(slotTypes[slotId])]++;
+            }
+        }
+        else if(heldSlots.empty() || step < 6){
+            VehicleType vehicleType = static_cast<VehicleType>(rng() % VEHICLE_TYPE_COUNT);
+            auto allocated = slotManager.allocateSlot(vehicleType);
+            if(allocated.has_value()){
+                auto [slotId, slotType] = allocated.value();
+                if(slotId < 1 || slotId > slotCount || held[slotId] || slotTypes[slotId] != slotType
+                    || !isSlotCompatible(slotType, vehicleType)){
+                    violations++;
+                    continue;
+                }
+                held[slotId] = true;
+                heldSlots.push_back(slotId);
+                heldByType[slotTypeIndex(slotType)]++;
+            }
+            else{
+                for(SlotType slotType : ALL_SLOT_TYPES){
+                    if(isSlotCompatible(slotType, vehicleType) && heldByType[slotTypeIndex(slotType)] < capacity[slotTypeIndex(slotType)]) violations++;
+                }
+            }
+        }
+        else{
+            std::swap(heldSlots[rng() % heldSlots.size()], heldSlots.back());
+            int slotId = heldSlots.back();
+            heldSlots.pop_back();
+            held[slotId] = false;
+            heldByType[slotTypeIndex(slotTypes[slotId])]--;
+            if(!slotManager.releaseSlot(slotId)) violations++;
+            if(slotManager.releaseSlot(slotId)) violations++; // a second release must not index the slot twice
+        }
+        for(SlotType slotType : ALL_SLOT_TYPES){
+            if(slotManager.getFreeCount(slotType) != capacity[slotTypeIndex(slotType)] - heldByType[slotTypeIndex(slotType)]) violations++;
+        }
+    }
+
+    FreeSlotIndex freeSlotIndex;
+    freeSlotIndex.addFreeSlot(3, SlotType::Large);
+    freeSlotIndex.addFreeSlot(3, SlotType::Large); // ignored, already free
+    freeSlotIndex.addFreeSlot(5, SlotType::Large);
+    if(freeSlotIndex.getFreeCount(SlotType::Large) != 2) violations++;
+    if(!freeSlotIndex.removeFreeSlot(3, SlotType::Large) || freeSlotIndex.removeFreeSlot(3, SlotType::Large)) violations++;
+    if(freeSlotIndex.removeFreeSlot(99, SlotType::Large)) violations++;
+    if(freeSlotIndex.getFreeCount(SlotType::Large) != 1 || freeSlotIndex.peekFreeSlot(SlotType::Large) != 5) violations++;
+    if(freeSlotIndex.peekFreeSlot(SlotType::Small) != -1) violations++;
+
+    std::cout << "Free slot index: " << operations << " random allocate/occupy/release steps, " << violations << " violations\n";
+    return violations == 0;
+}
+
+// Slots scattered over a floor plan with three gates; random parks through every gate (and an unknown one) and
+// random exits. Each pick must be free, compatible, and as close to its gate as the nearest compatible free slot a
+// brute-force scan finds (ties may go either way). False on any pick that isn't the nearest.
+bool runNearestToGateCheck(){
+    const int slotCount = 120;
+    const int operations = 50000;
+    const std::vector<SlotLocation> gates{{0.0, 0.0}, {100.0, 0.0}, {50.0, 80.0}};
+    SlotManager slotManager(std::make_unique<NearestToGateStrategy>(gates));
+    std::vector<SlotType> slotTypes(slotCount + 1);
+    std::vector<SlotLocation> slotLocations(slotCount + 1);
+    std::mt19937 rng(9);
+    for(int slotId = 1; slotId <= slotCount; slotId++){
+        slotTypes[slotId] = ALL_SLOT_TYPES[rng() % SLOT_TYPE_COUNT];
+        slotLocations[slotId] = SlotLocation{static_cast<double>(rng() % 101), static_cast<double>(rng() % 81)};
+        slotManager.addParkingSlot(slotTypes[slotId], slotLocations[slotId]);
+    }
+    auto distance = [](const SlotLocation& from, const SlotLocation& to){
+        return std::abs(from.x - to.x) + std::abs(from.y - to.y);
+    };
+
+    std::vector<bool> held(slotCount + 1, false);
+    std::vector<int> heldSlots;
+    int violations = 0;
+    for(int i = 0; i < operations; i++){
+        if(heldSlots.empty() || rng() % 2 == 0){
+            VehicleType vehicleType = static_cast<VehicleType>(rng() % VEHICLE_TYPE_COUNT);
+            int gateId = static_cast<int>(rng() % (gates.size() + 1)); // gates.size() is unknown, it falls back to gate 0
+            const SlotLocation& gate = gates[gateId < static_cast<int>(gates.size()) ? gateId : 0];
+            double nearest = -1.0;
+            for(int slotId = 1; slotId <= slotCount; slotId++){
+                if(held[slotId] || !isSlotCompatible(slotTypes[slotId], vehicleType)) continue;
+                double slotDistance = distance(gate, slotLocations[slotId]);
+                if(nearest < 0.0 || slotDistance < nearest) nearest = slotDistance;
+            }
+            auto allocated = slotManager.allocateSlot(vehicleType, gateId);
+            if(!allocated.has_value()){
+                if(nearest >= 0.0) violations++; // a compatible slot was free
+                continue;
+            }
+            int slotId = allocated -> first;
+            if(held[slotId] || !isSlotCompatible(slotTypes[slotId], vehicleType) || distance(gate, slotLocations[slotId]) != nearest){
+                violations++;
+                if(held[slotId]) continue;
+            }
+            held[slotId] = true; // even a wrong pick is occupied now, keep the model in step with the manager
+            heldSlots.push_back(slotId);
+        }
+        else{
+            std::swap(heldSlots[rng() % heldSlots.size()], heldSlots.back());
+            held[heldSlots.back()] = false;
+            if(!slotManager.releaseSlot(heldSlots.back())) violations++;
+            heldSlots.pop_back();
+        }
+    }
+    std::cout << "Nearest to gate: " << operations << " random parks/exits over " << gates.size() << " gates, "
+              << violations << " picks that weren't the nearest free compatible slot\n";
+    return violations == 0;
+}
+
+// Prices hand-computed edge stays through both priceTicket and the batch priceTickets path: a stay exactly at the
+// grace period and one minute past it, a stay on and just past the daily cap, multi-day stays, and stays crossing
+// midnight into the band that wraps from the previous evening. The batch spans more than one 256-ticket chunk.
+// False if either path misses the expected price or the two disagree.
+bool runTariffEdgeCaseCheck(){
+    // Small flat 30/h; Medium 60/h from 07:00 to 22:00 and 12/h overnight, with no band at midnight so 00:00-07:00
+    // is priced by the 22:00 band wrapping from yesterday; Large flat 90/h with no grace
+    Tariff tariff(std::array<SlotTariff, SLOT_TYPE_COUNT>{
+        SlotTariff{{{0, 30.0}}, 100.0, 10},
+        SlotTariff{{{7 * 60, 60.0}, {22 * 60, 12.0}}, 500.0, 15},
+        SlotTariff{{{0, 90.0}}, 900.0, 0}
+    });
+
+    struct EdgeCase{
+        SlotType slotType;
+        int entryMinuteOfDay;
+        long long stayMinutes;
+        double expected;
+    };
+    const long long day = 24 * 60;
+    const std::vector<EdgeCase> cases = {
+        {SlotType::Medium, 10 * 60, 15, 0.0},                  // exactly at grace
+        {SlotType::Medium, 10 * 60, 16, 16.0},                 // one minute past grace pays for all of it
+        {SlotType::Small, 23 * 60 + 50, 10, 0.0},              // grace across midnight
+        {SlotType::Small, 23 * 60 + 50, 11, 5.5},
+        {SlotType::Large, 12 * 60, 1, 1.5},                    // no grace at all
+        {SlotType::Large, 12 * 60, 0, 0.0},
+        {SlotType::Medium, 7 * 60, 500, 500.0},                // lands exactly on the cap
+        {SlotType::Medium, 7 * 60, 501, 500.0},                // just over it, still capped
+        {SlotType::Medium, 7 * 60, 499, 499.0},
+        {SlotType::Small, 0, 200, 100.0},                      // 200 min at 30/h is 100, right on the cap
+        {SlotType::Small, 0, 201, 100.0},
+        {SlotType::Medium, 7 * 60, 2 * day + 60, 2 * 500.0 + 60.0}, // a full day costs 1008 uncapped, so 500 each
+        {SlotType::Small, 6 * 60, 3 * day + 11, 3 * 100.0 + 5.5},
+        {SlotType::Large, 0, day, 900.0},                      // exactly one day, capped
+        {SlotType::Medium, 21 * 60, 10 * 60, 60.0 + 9 * 12.0}, // 21:00-07:00: 1h day rate, then 9h overnight
+        {SlotType::Medium, 2 * 60, 6 * 60, 5 * 12.0 + 60.0},   // 02:00 is still the wrapped 22:00 band
+        {SlotType::Medium, 23 * 60, day + 9 * 60, 500.0 + 8 * 12.0 + 60.0}, // a full day, then overnight into 08:00
+    };
+
+    const long long epochDay = 20000; // any whole day, minute-of-day is UTC here
+    std::vector<Ticket> tickets;
+    std::vector<double> expected;
+    for(int round = 0; tickets.size() <= 256; round++){
+        for(const EdgeCase& edge : cases){
+            TimePoint entryTime = TimePoint(std::chrono::minutes((epochDay + round) * day + edge.entryMinuteOfDay));
+            Ticket ticket(static_cast<TicketId>(tickets.size() + 1), "EDGE", 1, edge.slotType, entryTime);
+            ticket.closeTicket(entryTime + std::chrono::minutes(edge.stayMinutes));
+            tickets.push_back(ticket);
+            expected.push_back(edge.expected);
+        }
+        tickets.emplace_back(static_cast<TicketId>(tickets.size() + 1), "OPEN", 1, SlotType::Large, TimePoint(std::chrono::minutes(epochDay * day)));
+        expected.push_back(0.0); // still open, nothing to bill yet
+    }
+
+    std::vector<double> batchPrices = tariff.priceTickets(tickets);
+    int mismatches = 0;
+    for(std::size_t i = 0; i < tickets.size(); i++){
+        double single = tariff.priceTicket(tickets[i]);
+        if(std::abs(single - expected[i]) > 1e-6 || batchPrices[i] != single){
+            if(mismatches++ < 5){
+                std::cout << "    ticket " << i << ": expected " << expected[i] << ", priceTicket " << single << ", batch " << batchPrices[i] << "\n";
+            }
+        }
+    }
+    std::cout << "Tariff edge cases: " << tickets.size() << " tickets, " << mismatches << " mismatches\n";
+    return mismatches == 0;
+}
+
+// Hammers AtomicSlotManager from several threads. Every claimed slot bumps an owner counter,
+// seeing it already non-zero means two gates were handed the same slot.
+// False on any double allocation, failed release or leaked slot
+bool runAtomicSlotManagerStressTest(){
+    const int threadCount = std::max(4u, std::thread::hardware_concurrency());
+    const int iterationsPerThread = 200000;
+    AtomicSlotManager slotManager(100, 100, 37); // odd Large count exercises the padding bits
+    // together the threads want more slots than exist, so the lot saturates and gates fight over the last free bits
+    const std::size_t maxHeldPerThread = slotManager.getTotalSlots() / threadCount + 16;
+
+    std::vector<std::atomic<int>> owners(slotManager.getTotalSlots() + 1);
+    std::atomic<int> doubleAllocations{0};
+    std::atomic<int> failedReleases{0};
+    std::atomic<long long> lotFullAllocations{0};
+
+    auto gate = [&](int threadNo){
+        std::vector<int> held;
+        const VehicleType vehicleTypes[] = {VehicleType::Bike, VehicleType::Car, VehicleType::Truck};
+        for(int i = 0; i < iterationsPerThread; i++){
+            auto allocated = slotManager.allocateSlot(vehicleTypes[(i + threadNo) % 3]);
+            if(allocated.has_value()){
+                if(owners[allocated->first].fetch_add(1) != 0) doubleAllocations++;
+                held.push_back(allocated->first);
+            }
+            else lotFullAllocations++;
+            if(held.size() > maxHeldPerThread || (!allocated.has_value() && !held.empty())){
+                int slotId = held.front();
+                held.erase(held.begin());
+                owners[slotId].fetch_sub(1);
+                if(!slotManager.releaseSlot(slotId)) failedReleases++;
+            }
+        }
+        for(int slotId : held){
+            owners[slotId].fetch_sub(1);
+            if(!slotManager.releaseSlot(slotId)) failedReleases++;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; t++) threads.emplace_back(gate, t);
+    for(auto& thread : threads) thread.join();
+
+    bool allFree = slotManager.getFreeCount(SlotType::Small) == 100
+        && slotManager.getFreeCount(SlotType::Medium) == 100
+        && slotManager.getFreeCount(SlotType::Large) == 37;
+
+    std::cout << "AtomicSlotManager stress test (" << threadCount << " threads): "
+              << "double allocations = " << doubleAllocations
+              << ", failed releases = " << failedReleases
+              << ", allocations that found the lot full = " << lotFullAllocations
+              << ", all slots free at end = " << (allFree ? "yes" : "no") << "\n";
+    return doubleAllocations == 0 && failedReleases == 0 && allFree && lotFullAllocations > 0;
+}
+
+// Each thread parks/unparks on its own preferred floor. For 1, 2, 4 and 8 threads compare one shard (every gate on one
+// mutex) against one shard per thread. Sharding only pays off with cores to run the gates in parallel: with fewer cores
+// than threads both columns measure the same serialised work, so the report says how many cores it had.
+double measureShardedParkingThroughput(int shardCount, int threadCount, int operationsPerThread){
+    ShardedParkingLotSystem lot(shardCount);
+    for(int shard = 0; shard < shardCount; shard++){
+        for(int i = 0; i < 64 * threadCount / shardCount; i++) lot.addParkingSlot(shard, SlotType::Medium);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; t++){
+        threads.emplace_back([&lot, t, operationsPerThread](){
+            const std::string plate = "KA01-" + std::to_string(t); // one car per gate, plates must be unique
+            for(int i = 0; i < operationsPerThread; i++){
+                TicketId ticketId = lot.parkVehicle(plate, VehicleType::Car, t);
+                if(ticketId != -1) lot.unparkVehicle(ticketId);
+            }
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return threadCount * operationsPerThread / elapsed;
+}
+
+void runShardedParkingThroughputDemo(){
+    const int operationsPerThread = 100000;
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "ShardedParkingLotSystem park+unpark/s (" << cores << " core(s) available):\n";
+    for(int threadCount : {1, 2, 4, 8}){
+        double singleShard = measureShardedParkingThroughput(1, threadCount, operationsPerThread);
+        double shardPerThread = measureShardedParkingThroughput(threadCount, threadCount, operationsPerThread);
+        std::cout << "    " << threadCount << " thread(s): 1 shard " << static_cast<long long>(singleShard)
+                  << ", " << threadCount << " shard(s) " << static_cast<long long>(shardPerThread)
+                  << " (x" << shardPerThread / singleShard << ")"
+                  << (static_cast<unsigned>(threadCount) > cores ? ", more threads than cores: no parallel speedup possible" : "") << "\n";
+    }
+}
+
+// Same allocate/release churn through the virtual (SlotManager) and the policy (BasicSlotManager<SmallestFitStrategy>) variants
+template<typename Manager>
+double measureSlotManagerNanosPerOp(Manager& slotManager, int operations){
+    const VehicleType vehicleTypes[] = {VehicleType::Bike, VehicleType::Car, VehicleType::Truck};
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < operations; i++){
+        auto allocated = slotManager.allocateSlot(vehicleTypes[i % 3]);
+        if(allocated.has_value()) slotManager.releaseSlot(allocated->first);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / operations;
+}
+
+// The same churn with the lock taken out: select, then pull the slot from the index and put it back, as allocateSlot
+// and releaseSlot do under their mutex. Behind the lock the two lock/unlock pairs cost several times the selection,
+// so this is the only place the virtual call could show. With one strategy the indirect call is perfectly predicted,
+// so expect a small gap here too.
+template<typename Selection>
+double measureSelectionNanosPerOp(const Selection& selection, FreeSlotIndex& freeSlotIndex, const std::vector<SlotType>& slotTypes, int operations){
+    const VehicleType vehicleTypes[] = {VehicleType::Bike, VehicleType::Car, VehicleType::Truck};
+    long long checksum = 0; // printed by nobody, keeps the loop from being thrown away
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < operations; i++){
+        int slotId = selection.selectSlot(freeSlotIndex, vehicleTypes[i % 3], 0);
+        if(slotId == -1) continue;
+        freeSlotIndex.removeFreeSlot(slotId, slotTypes[slotId]);
+        freeSlotIndex.addFreeSlot(slotId, slotTypes[slotId]);
+        checksum += slotId;
+    }
+    double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / operations;
+    return checksum == -1 ? 0.0 : nanos;
+}
+
+void runSlotManagerPolicyBenchmark(){
+    const int operations = 2000000;
+    SlotManager dynamicManager(std::make_unique<SmallestFitStrategy>());
+    BasicSlotManager<SmallestFitStrategy> policyManager;
+    FreeSlotIndex freeSlotIndex;
+    std::vector<SlotType> slotTypes(1); // indexed by slotId
+    for(SlotType slotType : ALL_SLOT_TYPES){
+        for(int i = 0; i < 1000; i++){
+            dynamicManager.addParkingSlot(slotType);
+            policyManager.addParkingSlot(slotType);
+            freeSlotIndex.addFreeSlot(static_cast<int>(slotTypes.size()), slotType);
+            slotTypes.push_back(slotType);
+        }
+    }
+
+    std::cout << "SlotManager (virtual strategy): " << measureSlotManagerNanosPerOp(dynamicManager, operations) << " ns per allocate+release\n";
+    std::cout << "BasicSlotManager<SmallestFitStrategy>: " << measureSlotManagerNanosPerOp(policyManager, operations) << " ns per allocate+release\n";
+    // a few ns per op is easily swamped by a scheduler hiccup, so keep the best of several runs
+    DynamicSlotSelection dynamicSelection(std::make_unique<SmallestFitStrategy>());
+    double virtualNanos = 1e9;
+    double policyNanos = 1e9;
+    for(int run = 0; run < 5; run++){
+        virtualNanos = std::min(virtualNanos, measureSelectionNanosPerOp(dynamicSelection, freeSlotIndex, slotTypes, operations));
+        policyNanos = std::min(policyNanos, measureSelectionNanosPerOp(SmallestFitStrategy{}, freeSlotIndex, slotTypes, operations));
+    }
+    std::cout << "    without the lock (best of 5): virtual " << virtualNanos << " ns, policy " << policyNanos
+              << " ns per select+take+return\n";
+}
+
+// -------- Load benchmark harness --------
+
+// Log-linear latency histogram (HdrHistogram style): 32 linear sub-buckets per power of two, ~3% resolution, fixed memory.
+// One per thread, merged after the run, so recording never contends.
+class LatencyHistogram{
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_SHIFT = 40; // values up to ~2^45 ns (hours) before clamping
+    std::array<std::uint64_t, (MAX_SHIFT + 2) * SUB_BUCKETS> counts{};
+    std::uint64_t total = 0;
+
+    static int bucketOf(std::uint64_t value){
+        if(value < SUB_BUCKETS) return static_cast<int>(value);
+        int shift = std::min(63 - __builtin_clzll(value) - SUB_BUCKET_BITS, MAX_SHIFT);
+        int subBucket = static_cast<int>(std::min<std::uint64_t>(value >> shift, 2 * SUB_BUCKETS - 1)) - SUB_BUCKETS;
+        return (shift + 1) * SUB_BUCKETS + subBucket;
+    }
+
+    static std::uint64_t lowestValueOf(int bucket){
+        if(bucket < SUB_BUCKETS) return bucket;
+        int shift = bucket / SUB_BUCKETS - 1;
+        return static_cast<std::uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    }
+
+public:
+    void record(std::uint64_t value){
+        counts[bucketOf(value)]++;
+        total++;
+    }
+
+    void merge(const LatencyHistogram& other){
+        for(std::size_t i = 0; i < counts.size(); i++) counts[i] += other.counts[i];
+        total += other.total;
+    }
+
+    std::uint64_t getCount() const{
+        return total;
+    }
+
+    // percentile in [0, 100]
+    std::uint64_t valueAtPercentile(double percentile) const{
+        if(total == 0) return 0;
+        std::uint64_t target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(percentile / 100.0 * total)));
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < counts.size(); i++){
+            seen += counts[i];
+            if(seen >= target) return lowestValueOf(static_cast<int>(i));
+        }
+        return lowestValueOf(static_cast<int>(counts.size()) - 1);
+    }
+};
+
+enum class DwellDistribution{Fixed, Uniform, Exponential};
+
+// Each thread is a gate running a step loop: with arrivalProbability a new car (drawn from vehicleMix) parks and
+// gets a dwell time in steps from dwellDistribution; cars whose dwell is over unpark first.
+// meanDwellSteps vs the lot size decides how close to full the lot runs.
+struct LoadBenchmarkConfig{
+    int threads = 4;
+    int stepsPerThread = 50000;
+    int shards = 1;
+    int smallSlots = 200;
+    int mediumSlots = 600;
+    int largeSlots = 200;
+    std::array<double, VEHICLE_TYPE_COUNT> vehicleMix{0.6, 0.3, 0.1}; // Car, Bike, Truck weights
+    double arrivalProbability = 0.5;
+    DwellDistribution dwellDistribution = DwellDistribution::Exponential;
+    double meanDwellSteps = 400.0;
+};
+
+struct LoadBenchmarkResult{
+    LatencyHistogram parkLatency;
+    LatencyHistogram unparkLatency;
+    std::uint64_t rejectedParks = 0;
+    double seconds = 0.0;
+};
+
+// Runs one full benchmark against a fresh ShardedParkingLotSystem using the strategy makeStrategy() returns on every shard
+template<typename StrategyFactory>
+LoadBenchmarkResult runParkingLoadBenchmark(const LoadBenchmarkConfig& config, StrategyFactory makeStrategy){
+    ShardedParkingLotSystem lot(config.shards);
+    for(int shard = 0; shard < lot.getShardCount(); shard++){
+        lot.setSlotSelectionStrategy(shard, makeStrategy());
+        for(int i = 0; i < config.smallSlots / lot.getShardCount(); i++) lot.addParkingSlot(shard, SlotType::Small);
+        for(int i = 0; i < config.mediumSlots / lot.getShardCount(); i++) lot.addParkingSlot(shard, SlotType::Medium);
+        for(int i = 0; i < config.largeSlots / lot.getShardCount(); i++) lot.addParkingSlot(shard, SlotType::Large);
+    }
+
+    std::vector<LoadBenchmarkResult> perThread(config.threads);
+    auto gate = [&lot, &config](int threadNo, LoadBenchmarkResult& result){
+        std::mt19937_64 rng(12345 + threadNo);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::discrete_distribution<int> vehiclePick(config.vehicleMix.begin(), config.vehicleMix.end());
+        std::exponential_distribution<double> exponentialDwell(1.0 / std::max(1.0, config.meanDwellSteps));
+        // min-heap of {departure step, ticket}
+        std::priority_queue<std::pair<long long, TicketId>, std::vector<std::pair<long long, TicketId>>, std::greater<>> departures;
+        char plate[VehicleNumber::MAX_LENGTH + 1];
+        long long carNo = 0;
+
+        for(long long step = 0; step < config.stepsPerThread; step++){
+            while(!departures.empty() && departures.top().first <= step){
+                TicketId ticketId = departures.top().second;
+                departures.pop();
+                auto start = std::chrono::steady_clock::now();
+                lot.unparkVehicle(ticketId);
+                result.unparkLatency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+            if(unit(rng) >= config.arrivalProbability) continue;
+
+            int length = std::snprintf(plate, sizeof(plate), "G%d-%lld", threadNo, carNo++); // no heap, the lot sees a string_view
+            VehicleType vehicleType = static_cast<VehicleType>(vehiclePick(rng));
+            auto start = std::chrono::steady_clock::now();
+            TicketId ticketId = lot.parkVehicle(std::string_view(plate, length), vehicleType, threadNo);
+            result.parkLatency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            if(ticketId == -1){
+                result.rejectedParks++;
+                continue;
+            }
+            double dwell = config.meanDwellSteps;
+            if(config.dwellDistribution == DwellDistribution::Uniform) dwell = unit(rng) * 2.0 * config.meanDwellSteps;
+            else if(config.dwellDistribution == DwellDistribution::Exponential) dwell = exponentialDwell(rng);
+            departures.push({step + 1 + static_cast<long long>(dwell), ticketId});
+        }
+        while(!departures.empty()){ // drain so every run leaves the lot empty
+            lot.unparkVehicle(departures.top().second);
+            departures.pop();
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < config.threads; t++) threads.emplace_back(gate, t, std::ref(perThread[t]));
+    for(auto& thread : threads) thread.join();
+
+    LoadBenchmarkResult merged;
+    merged.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for(const LoadBenchmarkResult& result : perThread){
+        merged.parkLatency.merge(result.parkLatency);
+        merged.unparkLatency.merge(result.unparkLatency);
+        merged.rejectedParks += result.rejectedParks;
+    }
+    return merged;
+}
+
+void printLoadBenchmarkResult(const std::string& strategyName, const LoadBenchmarkResult& result){
+    auto printLatency = [](const char* operation, const LatencyHistogram& histogram){
+        std::cout << "    " << std::setw(7) << operation << " n=" << histogram.getCount()
+                  << " p50=" << histogram.valueAtPercentile(50) << "ns"
+                  << " p99=" << histogram.valueAtPercentile(99) << "ns"
+                  << " p999=" << histogram.valueAtPercentile(99.9) << "ns\n";
+    };
+    std::uint64_t operations = result.parkLatency.getCount() + result.unparkLatency.getCount();
+    std::cout << "  " << strategyName << ": " << static_cast<long long>(operations / result.seconds) << " ops/s, "
+              << result.rejectedParks << " rejected parks\n";
+    printLatency("park", result.parkLatency);
+    printLatency("unpark", result.unparkLatency);
+}
+
+void runParkingLoadBenchmarks(const LoadBenchmarkConfig& config){
+    std::cout << "Parking load benchmark: " << config.threads << " threads x " << config.stepsPerThread << " steps, "
+              << config.shards << " shard(s), lot " << config.smallSlots << "S/" << config.mediumSlots << "M/" << config.largeSlots << "L\n";
+    printLoadBenchmarkResult("FirstAvailableStrategy", runParkingLoadBenchmark(config, [](){ return std::make_unique<FirstAvailableStrategy>(); }));
+    printLoadBenchmarkResult("SmallestFitStrategy", runParkingLoadBenchmark(config, [](){ return std::make_unique<SmallestFitStrategy>(); }));
+}
+
+// -------- Trace replay --------
+
+// One gate log line: "<unix seconds>,<plate>,<Car|Bike|Truck>,<IN|OUT>", '#' starts a comment line
+struct TraceEvent{
+    std::int64_t timestampSeconds = 0;
+    std::string_view plate; // points into TraceReader's buffer, valid until the next call to next()
+    VehicleType vehicleType = VehicleType::Car;
+    bool isEntry = true;
+};
+
+// Streams a trace file in fixed-size chunks: lines are parsed in place (no std::string per line) and only the
+// partial line at the end of a chunk is carried over, so memory stays at one chunk however big the trace is.
+class TraceReader{
+    static constexpr std::size_t CHUNK_SIZE = 1 << 20;
+
+    std::FILE* file = nullptr;
+    std::vector<char> buffer;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    bool eof = false;
+    std::uint64_t malformedLines = 0;
+
+    bool refill(){
+        if(eof) return false;
+        std::size_t carried = end - begin;
+        std::copy(buffer.begin() + begin, buffer.begin() + end, buffer.begin());
+        if(carried == buffer.size()) buffer.resize(buffer.size() * 2); // a line longer than a chunk, grow once
+        std::size_t read = std::fread(buffer.data() + carried, 1, buffer.size() - carried, file);
+        begin = 0;
+        end = carried + read;
+        if(read == 0) eof = true;
+        return read != 0;
+    }
+
+    static bool parseVehicleType(std::string_view field, VehicleType& vehicleType){
+        if(field == "Car") vehicleType = VehicleType::Car;
+        else if(field == "Bike") vehicleType = VehicleType::Bike;
+        else if(field == "Truck") vehicleType = VehicleType::Truck;
+        else return false;
+        return true;
+    }
+
+    bool parseLine(std::string_view line, TraceEvent& event){
+        if(!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        std::array<std::string_view, 4> fields;
+        for(std::size_t i = 0; i < fields.size(); i++){
+            std::size_t comma = i + 1 < fields.size() ? line.find(',') : line.size();
+            if(comma == std::string_view::npos) return false;
+            fields[i] = line.substr(0, comma);
+            line.remove_prefix(std::min(line.size(), comma + 1));
+        }
+        std::int64_t timestamp = 0;
+        if(fields[0].empty()) return false;
+        for(char c : fields[0]){
+            if(c < '0' || c > '9') return false;
+            timestamp = timestamp * 10 + (c - '0');
+        }
+        if(fields[1].empty() || !parseVehicleType(fields[2], event.vehicleType)) return false;
+        if(fields[3] == "IN") event.isEntry = true;
+        else if(fields[3] == "OUT") event.isEntry = false;
+        else return false;
+        event.timestampSeconds = timestamp;
+        event.plate = fields[1];
+        return true;
+    }
+
+public:
+    explicit TraceReader(const std::string& path) : file(std::fopen(path.c_str(), "rb")), buffer(CHUNK_SIZE){}
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    ~TraceReader(){
+        if(file != nullptr) std::fclose(file);
+    }
+
+    bool isOpen() const{
+        return file != nullptr;
+    }
+
+    std::uint64_t getMalformedLines() const{
+        return malformedLines;
+    }
+
+    // False at end of file. Blank, comment and malformed lines are skipped (malformed ones are counted).
+    bool next(TraceEvent& event){
+        if(file == nullptr) return false;
+        while(true){
+            const char* newline = static_cast<const char*>(std::memchr(buffer.data() + begin, '\n', end - begin));
+            std::string_view line;
+            if(newline != nullptr){
+                line = std::string_view(buffer.data() + begin, newline - (buffer.data() + begin));
+                begin = newline - buffer.data() + 1;
+            }
+            else if(refill()) continue;
+            else if(begin < end){ // last line without a trailing newline
+                line = std::string_view(buffer.data() + begin, end - begin);
+                begin = end;
+            }
+            else return false;
+
+            if(line.empty() || line.front() == '#' || line == "\r") continue;
+            if(parseLine(line, event)) return true;
+            malformedLines++;
+        }
+    }
+};
+
+struct OccupancySample{
+    std::int64_t timestampSeconds = 0;
+    std::array<int, SLOT_TYPE_COUNT> occupied{};
+};
+
+struct ReplayReport{
+    std::uint64_t events = 0;
+    std::uint64_t entries = 0;
+    std::uint64_t exits = 0;
+    std::uint64_t rejectedEntries = 0; // lot full for that vehicle type, or the plate was already inside
+    std::uint64_t unmatchedExits = 0;  // OUT for a plate that isn't parked (its IN was rejected, or started before the trace)
+    std::uint64_t malformedLines = 0;
+    double revenue = 0.0;
+    std::vector<OccupancySample> occupancyCurve; // one sample per sampleInterval of trace time
+    double wallSeconds = 0.0;
+};
+
+// Feeds a gate trace into a lot driven by a VirtualClock, so tickets are stamped and priced with trace time.
+// speed 0 replays as fast as possible, 1 at recorded speed, 60 a minute of trace per second, ...
+// The lot should be freshly configured (slots, strategy, tariff) and empty: free counts at start are taken as capacity.
+ReplayReport replayTrace(ShardedParkingLotSystem& lot, const std::string& tracePath,
+    double speed = 0.0, std::chrono::seconds sampleInterval = std::chrono::minutes(15)){
+    ReplayReport report;
+    TraceReader reader(tracePath);
+    if(!reader.isOpen()) return report;
+
+    auto clock = std::make_shared<VirtualClock>();
+    lot.setClock(clock);
+    std::array<int, SLOT_TYPE_COUNT> capacity{};
+    for(SlotType slotType : ALL_SLOT_TYPES) capacity[slotTypeIndex(slotType)] = lot.getFreeCount(slotType);
+
+    auto wallStart = std::chrono::steady_clock::now();
+    std::int64_t traceStart = -1;
+    std::int64_t nextSampleAt = 0;
+    const std::int64_t sampleSeconds = std::max<std::int64_t>(1, sampleInterval.count());
+
+    TraceEvent event;
+    while(reader.next(event)){
+        if(traceStart == -1){
+            traceStart = event.timestampSeconds;
+            nextSampleAt = traceStart;
+        }
+        while(event.timestampSeconds >= nextSampleAt){ // samples describe the lot just before the first event at or after them
+            OccupancySample sample;
+            sample.timestampSeconds = nextSampleAt;
+            for(SlotType slotType : ALL_SLOT_TYPES){
+                sample.occupied[slotTypeIndex(slotType)] = capacity[slotTypeIndex(slotType)] - lot.getFreeCount(slotType);
+            }
+            report.occupancyCurve.push_back(sample);
+            nextSampleAt += sampleSeconds;
+        }
+        if(speed > 0.0){
+            auto due = wallStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>((event.timestampSeconds - traceStart) / speed));
+            std::this_thread::sleep_until(due);
+        }
+        clock -> set(TimePoint(std::chrono::duration_cast<TimePoint::duration>(std::chrono::seconds(event.timestampSeconds))));
+
+        report.events++;
+        if(event.isEntry){
+            report.entries++;
+            if(lot.parkVehicle(event.plate, event.vehicleType, 0) == -1) report.rejectedEntries++;
+        }
+        else{
+            report.exits++;
+            std::optional<TicketId> ticketId = lot.findTicketByVehicleNumber(event.plate);
+            if(ticketId.has_value()) report.revenue += lot.unparkVehicle(ticketId.value());
+            else report.unmatchedExits++;
+        }
+    }
+    report.malformedLines = reader.getMalformedLines();
+    report.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    lot.setClock(SystemClock::instance());
+    return report;
+}
+
+// Writes a synthetic day of gate traffic to a temp file and replays it as fast as possible
+void runTraceReplayDemo(){
+    std::string tracePath = (std::filesystem::temp_directory_path() / "parking_trace_demo.csv").string();
+    {
+        std::FILE* trace = std::fopen(tracePath.c_str(), "wb");
+        if(trace == nullptr) return;
+        std::mt19937_64 rng(7);
+        std::exponential_distribution<double> dwellMinutes(1.0 / 90.0);
+        const char* vehicleNames[] = {"Car", "Bike", "Truck"};
+        std::discrete_distribution<int> vehiclePick{0.6, 0.3, 0.1};
+        // {time, plate, type, isEntry} generated then sorted, a real log would already be in order
+        std::vector<std::tuple<std::int64_t, int, int, bool>> events;
+        const std::int64_t dayStart = 1700000000 - 1700000000 % 86400;
+        for(int car = 0; car < 20000; car++){
+            std::int64_t arrival = dayStart + static_cast<std::int64_t>(std::uniform_real_distribution<double>(0, 86400)(rng));
+            int vehicleType = vehiclePick(rng);
+            events.emplace_back(arrival, car, vehicleType, true);
+            events.emplace_back(arrival + 60 + static_cast<std::int64_t>(dwellMinutes(rng) * 60), car, vehicleType, false);
+        }
+        std::sort(events.begin(), events.end());
+        std::fprintf(trace, "# timestamp,plate,vehicleType,direction\n");
+        for(const auto& [timestamp, car, vehicleType, isEntry] : events){
+            std::fprintf(trace, "%lld,KA%06d,%s,%s\n", static_cast<long long>(timestamp), car, vehicleNames[vehicleType], isEntry ? "IN" : "OUT");
+        }
+        std::fclose(trace);
+    }
+
+    ShardedParkingLotSystem lot(1);
+    for(int i = 0; i < 1500; i++) lot.addParkingSlot(0, i < 400 ? SlotType::Small : (i < 1300 ? SlotType::Medium : SlotType::Large));
+    ReplayReport report = replayTrace(lot, tracePath, 0.0, std::chrono::hours(3));
+
+    std::cout << "Trace replay: " << report.events << " events in " << report.wallSeconds << "s, "
+              << report.rejectedEntries << " rejected entries, " << report.unmatchedExits << " unmatched exits, revenue "
+              << report.revenue << "\n";
+    for(const OccupancySample& sample : report.occupancyCurve){
+        std::cout << "    t+" << (sample.timestampSeconds - report.occupancyCurve.front().timestampSeconds) / 3600 << "h occupied S/M/L = "
+                  << sample.occupied[0] << "/" << sample.occupied[1] << "/" << sample.occupied[2] << "\n";
+    }
+    std::filesystem::remove(tracePath);
+}
+
+// Gates park/unpark while a signage consumer keeps live counts and a billing consumer sums fees off the bus.
+// First with a ring big enough for the whole run, so nothing can be lost and signage must end at the lot's real
+// occupancy and billing at the gates' revenue. Then overloaded on a small ring: the consumers may be lapped, but
+// every event is still either received or counted as lost. False on any mismatch.
+bool runOccupancyEventBusDemo(){
+    const int threadCount = 4;
+    const int slotsPerShard = 256;
+
+    struct BusRun{
+        std::uint64_t published = 0;
+        std::uint64_t gateEvents = 0; // parks + unparks that succeeded
+        std::uint64_t received[2] = {0, 0};
+        std::uint64_t lost[2] = {0, 0};
+        long long signageOccupied = 0;
+        int lotOccupied = 0;
+        double billedRevenue = 0.0;
+        double gateRevenue = 0.0;
+        double gatesSeconds = 0.0;
+    };
+
+    auto runGates = [threadCount, slotsPerShard](std::size_t ringCapacity, int operationsPerThread){
+        BusRun run;
+        OccupancyEventBus bus(ringCapacity);
+        ShardedParkingLotSystem lot(threadCount);
+        for(int shard = 0; shard < threadCount; shard++){
+            for(int i = 0; i < slotsPerShard; i++) lot.addParkingSlot(shard, SlotType::Medium);
+        }
+        lot.setEventBus(&bus);
+        // every reading moves time a minute forward so stays outlast the grace period and produce fees
+        struct MinutePerReadClock final : IClock{
+            mutable std::atomic<std::int64_t> minutes{0};
+            TimePoint now() const override{
+                return TimePoint(std::chrono::duration_cast<TimePoint::duration>(std::chrono::minutes(minutes.fetch_add(1, std::memory_order_relaxed))));
+            }
+        };
+        lot.setClock(std::make_shared<MinutePerReadClock>());
+
+        std::atomic<bool> gatesDone{false};
+        std::array<long long, SLOT_TYPE_COUNT> signageOccupied{};
+        OccupancyEventBus::ConsumerId signage = bus.subscribe();
+        OccupancyEventBus::ConsumerId billing = bus.subscribe();
+
+        auto consume = [&bus, &gatesDone](OccupancyEventBus::ConsumerId consumerId, const std::function<void(const OccupancyEvent&)>& onEvent){
+            std::vector<OccupancyEvent> batch(1024);
+            std::uint64_t received = 0;
+            while(true){
+                bool finished = gatesDone.load(std::memory_order_acquire); // read before draining so the last batch is complete
+                std::size_t count = bus.drain(consumerId, batch.data(), batch.size());
+                for(std::size_t i = 0; i < count; i++) onEvent(batch[i]);
+                received += count;
+                if(count == 0){
+                    if(finished) break;
+                    std::this_thread::yield();
+                }
+            }
+            return received;
+        };
+        std::thread signageThread([&](){
+            run.received[0] = consume(signage, [&signageOccupied](const OccupancyEvent& event){
+                signageOccupied[static_cast<int>(event.slotType)] += event.type == OccupancyEventType::Parked ? 1 : -1;
+            });
+            run.lost[0] = bus.getLostCount(signage);
+        });
+        std::thread billingThread([&](){
+            run.received[1] = consume(billing, [&run](const OccupancyEvent& event){
+                if(event.type == OccupancyEventType::Unparked) run.billedRevenue += event.fee;
+            });
+            run.lost[1] = bus.getLostCount(billing);
+        });
+
+        std::vector<double> gateRevenue(threadCount, 0.0);
+        std::vector<std::uint64_t> gateEvents(threadCount, 0);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> gates;
+        for(int t = 0; t < threadCount; t++){
+            gates.emplace_back([&lot, &gateRevenue, &gateEvents, t, operationsPerThread](){
+                std::vector<TicketId> parked;
+                for(int i = 0; i < operationsPerThread; i++){
+                    if(parked.size() < 200){
+                        TicketId ticketId = lot.parkVehicle("EV" + std::to_string(t) + "-" + std::to_string(i), VehicleType::Car, t);
+                        if(ticketId == -1) continue;
+                        parked.push_back(ticketId);
+                    }
+                    else{
+                        gateRevenue[t] += lot.unparkVehicle(parked.back());
+                        parked.pop_back();
+                    }
+                    gateEvents[t]++;
+                }
+            });
+        }
+        for(auto& gate : gates) gate.join();
+        run.gatesSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        gatesDone.store(true, std::memory_order_release);
+        signageThread.join();
+        billingThread.join();
+        lot.setEventBus(nullptr);
+
+        for(int t = 0; t < threadCount; t++){
+            run.gateRevenue += gateRevenue[t];
+            run.gateEvents += gateEvents[t];
+        }
+        run.published = bus.getPublishedCount();
+        run.signageOccupied = signageOccupied[slotTypeIndex(SlotType::Medium)];
+        run.lotOccupied = threadCount * slotsPerShard - lot.getFreeCount(SlotType::Medium);
+        return run;
+    };
+
+    bool ok = true;
+    // Fee sums are added in a different order by the gates and by billing
+    auto sameRevenue = [](double a, double b){ return std::abs(a - b) <= 1e-9 * std::max(1.0, std::abs(b)); };
+
+    const int keptUpOperations = 20000;
+    BusRun keptUp = runGates(threadCount * keptUpOperations, keptUpOperations);
+    bool keptUpOk = keptUp.published == keptUp.gateEvents
+        && keptUp.lost[0] == 0 && keptUp.lost[1] == 0
+        && keptUp.received[0] == keptUp.published && keptUp.received[1] == keptUp.published
+        && keptUp.signageOccupied == keptUp.lotOccupied
+        && sameRevenue(keptUp.billedRevenue, keptUp.gateRevenue);
+    ok = ok && keptUpOk;
+    std::cout << "Occupancy event bus (ring holds the whole run): " << keptUp.published << " events, "
+              << "signage occupied " << keptUp.signageOccupied << " (lot says " << keptUp.lotOccupied << "), "
+              << "billed " << keptUp.billedRevenue << " (gates took " << keptUp.gateRevenue << ") "
+              << (keptUpOk ? "ok" : "MISMATCH") << "\n";
+
+    const int overloadOperations = 200000;
+    BusRun overload = runGates(1 << 10, overloadOperations);
+    bool overloadOk = overload.published == overload.gateEvents
+        && overload.received[0] + overload.lost[0] == overload.published
+        && overload.received[1] + overload.lost[1] == overload.published;
+    // a consumer that was never lapped still saw everything
+    if(overload.lost[0] == 0) overloadOk = overloadOk && overload.signageOccupied == overload.lotOccupied;
+    if(overload.lost[1] == 0) overloadOk = overloadOk && sameRevenue(overload.billedRevenue, overload.gateRevenue);
+    ok = ok && overloadOk;
+    std::cout << "    overloaded 1024-event ring: " << overload.published << " events published while gates ran "
+              << static_cast<long long>(threadCount * overloadOperations / overload.gatesSeconds) << " ops/s, "
+              << "received " << overload.received[0] << "/" << overload.received[1]
+              << " + lost " << overload.lost[0] << "/" << overload.lost[1] << " " << (overloadOk ? "ok" : "MISMATCH") << "\n";
+
+    // Raw publish cost, one thread, no consumer attached
+    OccupancyEventBus idleBus(1 << 12);
+    OccupancyEvent event;
+    const int publishes = 5000000;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < publishes; i++){
+        event.ticketId = i;
+        idleBus.publish(event);
+    }
+    std::cout << "    publish: " << std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / publishes
+              << " ns/event\n";
+    return ok;
+}
+
+// Gates churn on four floors with Small, Medium and Large slots while a dashboard thread keeps taking snapshots:
+// no snapshot may show a floor below zero or above capacity. Once the gates stop, every floor and SlotType must match
+// an exact recount taken from the event bus (parks, unparks, occupancy, dwell) and the lot's own free counts.
+// False on any inconsistent snapshot, mismatch, or a SlotType the run never parked in.
+bool runOccupancyAnalyticsDemo(){
+    const int floorCount = 4;
+    const int slotsPerFloor = 300;
+    const int operationsPerGate = 30000;
+    ShardedParkingLotSystem lot(floorCount);
+    for(int floor = 0; floor < floorCount; floor++){
+        for(int i = 0; i < slotsPerFloor; i++) lot.addParkingSlot(floor, ALL_SLOT_TYPES[i % SLOT_TYPE_COUNT]);
+        lot.setSlotSelectionStrategy(floor, std::make_unique<SmallestFitStrategy>()); // bikes, cars and trucks each fill their own type
+    }
+    OccupancyAnalytics analytics(floorCount, 120);
+    lot.setAnalytics(&analytics);
+    // big enough for every event of the run, so the recount never misses one
+    OccupancyEventBus recountBus(static_cast<std::size_t>(floorCount) * operationsPerGate);
+    OccupancyEventBus::ConsumerId recount = recountBus.subscribe();
+    lot.setEventBus(&recountBus);
+    struct SecondsPerReadClock final : IClock{ // 20 reads a minute, so the run spans a few hours of rollups
+        mutable std::atomic<std::int64_t> seconds{0};
+        TimePoint now() const override{
+            return TimePoint(std::chrono::duration_cast<TimePoint::duration>(std::chrono::seconds(3 * seconds.fetch_add(1, std::memory_order_relaxed))));
+        }
+    };
+    lot.setClock(std::make_shared<SecondsPerReadClock>());
+
+    std::atomic<bool> gatesDone{false};
+    int snapshots = 0;
+    int inconsistentSnapshots = 0;
+    std::thread dashboard([&](){
+        while(!gatesDone.load(std::memory_order_acquire)){
+            AnalyticsSnapshot snapshot = analytics.snapshot();
+            snapshots++;
+            for(const auto& floor : snapshot.floors){
+                for(const SlotTypeStats& stats : floor){
+                    if(stats.occupied < 0 || stats.occupied > stats.capacity) inconsistentSnapshots++;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    std::vector<std::thread> gates;
+    for(int floor = 0; floor < floorCount; floor++){
+        gates.emplace_back([&lot, floor, operationsPerGate](){
+            std::mt19937 rng(floor);
+            std::vector<TicketId> parked;
+            for(int i = 0; i < operationsPerGate; i++){
+                if(parked.empty() || (parked.size() < 250 && rng() % 2 == 0)){
+                    unsigned pick = rng() % 4;
+                    VehicleType vehicleType = pick == 0 ? VehicleType::Bike : pick == 1 ? VehicleType::Truck : VehicleType::Car;
+                    TicketId ticketId = lot.parkVehicle("AN" + std::to_string(floor) + "-" + std::to_string(i), vehicleType, floor);
+                    if(ticketId != -1) parked.push_back(ticketId);
+                }
+                else{
+                    std::swap(parked[rng() % parked.size()], parked.back()); // random exits give a spread of dwell times
+                    lot.unparkVehicle(parked.back());
+                    parked.pop_back();
+                }
+            }
+        });
+    }
+    for(auto& gate : gates) gate.join();
+    gatesDone.store(true, std::memory_order_release);
+    dashboard.join();
+
+    AnalyticsSnapshot snapshot = analytics.snapshot();
+    lot.setAnalytics(nullptr);
+    lot.setEventBus(nullptr);
+
+    // Recount: parks, unparks and summed dwell seconds per [floor][SlotType], dwell matched by ticket id
+    struct CellCount{
+        std::uint64_t parks = 0;
+        std::uint64_t unparks = 0;
+        std::int64_t dwellSeconds = 0;
+    };
+    std::vector<std::array<CellCount, SLOT_TYPE_COUNT>> counted(floorCount);
+    std::unordered_map<TicketId, std::int64_t> entryTicks;
+    std::vector<OccupancyEvent> batch(4096);
+    std::uint64_t drained = 0;
+    while(std::size_t count = recountBus.drain(recount, batch.data(), batch.size())){
+        drained += count;
+        for(std::size_t i = 0; i < count; i++){
+            const OccupancyEvent& event = batch[i];
+            CellCount& cell = counted[event.shardIndex][slotTypeIndex(event.slotType)];
+            if(event.type == OccupancyEventType::Parked){
+                cell.parks++;
+                entryTicks[event.ticketId] = event.timeTicks;
+                continue;
+            }
+            cell.unparks++;
+            auto entry = entryTicks.find(event.ticketId);
+            if(entry == entryTicks.end()) continue; // can't happen, and leaves the dwell short so the check below fails
+            TimePoint::duration stay(event.timeTicks - entry -> second);
+            cell.dwellSeconds += std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::seconds>(stay).count());
+            entryTicks.erase(entry);
+        }
+    }
+
+    int mismatches = 0;
+    if(drained != recountBus.getPublishedCount() || recountBus.getLostCount(recount) != 0) mismatches++;
+    std::array<std::uint64_t, SLOT_TYPE_COUNT> parksByType{};
+    for(int floor = 0; floor < floorCount; floor++){
+        for(SlotType slotType : ALL_SLOT_TYPES){
+            const int type = slotTypeIndex(slotType);
+            const SlotTypeStats& stats = snapshot.floors[floor][type];
+            const CellCount& cell = counted[floor][type];
+            double expectedDwell = cell.unparks == 0 ? 0.0 : cell.dwellSeconds / 60.0 / cell.unparks;
+            parksByType[type] += cell.parks;
+            if(stats.capacity != slotsPerFloor / SLOT_TYPE_COUNT
+                || stats.parks != cell.parks || stats.unparks != cell.unparks
+                || stats.occupied != static_cast<int>(cell.parks - cell.unparks)
+                || std::abs(stats.averageDwellMinutes - expectedDwell) > 1e-9 * std::max(1.0, expectedDwell)) mismatches++;
+        }
+    }
+    for(SlotType slotType : ALL_SLOT_TYPES){
+        const SlotTypeStats& total = snapshot.total[slotTypeIndex(slotType)];
+        if(total.capacity - total.occupied != lot.getFreeCount(slotType)) mismatches++;
+        if(parksByType[slotTypeIndex(slotType)] == 0) mismatches++; // the run must exercise every SlotType
+    }
+
+    std::cout << "Occupancy analytics: " << snapshots << " live snapshots, " << inconsistentSnapshots << " inconsistent, "
+              << mismatches << " mismatches against a recount of " << drained << " events, "
+              << snapshot.recentMinutes.size() << " minutes retained\n";
+    const char* slotTypeNames[] = {"Small", "Medium", "Large"};
+    for(SlotType slotType : ALL_SLOT_TYPES){
+        const SlotTypeStats& total = snapshot.total[slotTypeIndex(slotType)];
+        std::cout << "    " << slotTypeNames[slotTypeIndex(slotType)] << ": " << total.occupied << "/" << total.capacity
+                  << " occupied, avg dwell " << total.averageDwellMinutes << " min, turnover "
+                  << snapshot.turnoverPerSlotHour[slotTypeIndex(slotType)] << " /slot/h\n";
+    }
+    return inconsistentSnapshots == 0 && mismatches == 0;
+}
+
+// Same single-gate park/unpark churn stamped by the precise clock and by the coarse one
+void runCoarseClockParkingDemo(){
+    const int operations = 1000000;
+    auto coarseClock = std::make_shared<CoarseSystemClock>(std::chrono::milliseconds(1));
+    for(const std::shared_ptr<const IClock>& clock : {SystemClock::instance(), std::shared_ptr<const IClock>(coarseClock)}){
+        ShardedParkingLotSystem lot(1);
+        for(int i = 0; i < 64; i++) lot.addParkingSlot(0, SlotType::Medium);
+        lot.setClock(clock);
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < operations; i++){
+            TicketId ticketId = lot.parkVehicle("CLK-1", VehicleType::Car, 0);
+            if(ticketId != -1) lot.unparkVehicle(ticketId);
+        }
+        std::cout << (clock == SystemClock::instance() ? "SystemClock       " : "CoarseSystemClock ") << "park+unpark: "
+                  << std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / operations << " ns\n";
+    }
+}
+
+// A child process journals a 2-floor lot: parks 300 cars, lets a few snapshots roll the journal, unparks half of
+// them and is then SIGKILLed, so nothing gets a clean shutdown. This process rebuilds the same layout, recovers it
+// through openJournal and checks the result: exactly the 150 cars still inside, on their slots, and the lot usable.
+bool runJournalRecoveryDemo(){
+    const std::string directory = (std::filesystem::temp_directory_path() / "parking_journal_demo").string();
+    const int shardCount = 2;
+    const int slotsPerShard = 200;
+    const int cars = 300;
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+
+    auto buildLot = [&](){
+        auto lot = std::make_unique<ShardedParkingLotSystem>(shardCount);
+        for(int shard = 0; shard < shardCount; shard++){
+            for(int i = 0; i < slotsPerShard; i++) lot -> addParkingSlot(shard, SlotType::Medium);
+        }
+        return lot;
+    };
+    auto plateOf = [](int car){ return "JR-" + std::to_string(car); };
+
+    pid_t child = ::fork();
+    if(child < 0) return false;
+    if(child == 0){
+        auto lot = buildLot();
+        if(lot -> openJournal(directory, std::chrono::milliseconds(20)) != 0) ::_exit(1);
+        std::vector<TicketId> tickets;
+        for(int car = 0; car < cars; car++) tickets.push_back(lot -> parkVehicle(plateOf(car), VehicleType::Car, car % shardCount));
+        std::this_thread::sleep_for(std::chrono::milliseconds(70)); // a few snapshots + rotations
+        for(int car = 0; car < cars; car += 2) lot -> unparkVehicle(tickets[car]);
+        std::this_thread::sleep_for(std::chrono::milliseconds(30)); // past the 5ms group commit: every event is durable
+        ::raise(SIGKILL);
+    }
+    int status = 0;
+    ::waitpid(child, &status, 0);
+
+    auto lot = buildLot();
+    int recovered = lot -> openJournal(directory);
+    bool ok = WIFSIGNALED(status) && recovered == cars / 2
+        && lot -> getFreeCount(SlotType::Medium) == shardCount * slotsPerShard - cars / 2;
+    for(int car = 0; car < cars; car++){
+        bool found = lot -> findTicketByVehicleNumber(plateOf(car)).has_value();
+        if(found != (car % 2 == 1)) ok = false;
+    }
+    // recovered tickets close normally and their slots come back
+    for(int car = 1; car < cars; car += 2){
+        std::optional<TicketId> ticketId = lot -> findTicketByVehicleNumber(plateOf(car));
+        if(ticketId.has_value()) lot -> unparkVehicle(ticketId.value());
+    }
+    ok = ok && lot -> getFreeCount(SlotType::Medium) == shardCount * slotsPerShard
+        && lot -> parkVehicle(plateOf(1), VehicleType::Car, 0) != -1;
+
+    std::cout << "Journal recovery after SIGKILL: " << recovered << " open tickets recovered (expected " << cars / 2
+              << "), state matches = " << (ok ? "yes" : "no") << "\n";
+    lot.reset();
+    std::filesystem::remove_all(directory, ec);
+    return ok;
+}
+
+// Reserve -> claim -> expiry on a VirtualClock, with a 10ms wheel: holds of 5 min, 10 min and 30 min (the last one
+// starts two levels up and has to cascade down). No hold may lapse before its deadline and each must lapse within a
+// few real ticks once the clock passes it. Then 100k pending holds, to check they don't slow park/unpark down, and a
+// replay-style clock jump from 0 to a 1.7e9 s trace timestamp, which the wheel must catch up on without stalling callers.
+bool runReservationDemo(){
+    const std::chrono::milliseconds tick(10);
+    auto clock = std::make_shared<VirtualClock>(TimePoint(std::chrono::hours(24 * 365 * 50)));
+    ShardedParkingLotSystem lot(1, tick);
+    lot.setClock(clock);
+    for(int i = 0; i < 8; i++) lot.addParkingSlot(0, SlotType::Medium);
+
+    auto heldCount = [&lot](){ return lot.getHeldCount(0); };
+    // the wheel thread looks at the clock once per real tick, give it a few
+    auto settle = [tick](){ std::this_thread::sleep_for(tick * 5); };
+    auto advanceTo = [&](std::chrono::minutes offset, TimePoint start){ clock -> set(start + offset); settle(); };
+
+    const TimePoint start = clock -> now();
+    ReservationId claimed = lot.reserveSlot(0, "RS-CLAIM", SlotType::Medium, start + std::chrono::minutes(5));
+    ReservationId shortHold = lot.reserveSlot(0, "RS-10MIN", SlotType::Medium, start + std::chrono::minutes(10));
+    ReservationId longHold = lot.reserveSlot(0, "RS-30MIN", SlotType::Medium, start + std::chrono::minutes(30));
+    bool ok = claimed != -1 && shortHold != -1 && longHold != -1 && heldCount() == 3
+        && lot.getFreeCount(SlotType::Medium) == 5
+        && lot.reserveSlot(0, "RS-10MIN", SlotType::Medium, start + std::chrono::minutes(10)) == -1; // plate already held
+
+    TicketId ticketId = lot.claimReservation(claimed);
+    ok = ok && ticketId != -1 && heldCount() == 2 && lot.claimReservation(claimed) == -1;
+
+    advanceTo(std::chrono::minutes(9), start);
+    ok = ok && heldCount() == 2; // nothing early
+    advanceTo(std::chrono::minutes(11), start);
+    ok = ok && heldCount() == 1 && lot.claimReservation(shortHold) == -1 && !lot.findTicketByVehicleNumber("RS-10MIN").has_value();
+    advanceTo(std::chrono::minutes(29), start);
+    ok = ok && heldCount() == 1;
+    advanceTo(std::chrono::minutes(31), start);
+    ok = ok && heldCount() == 0 && lot.getFreeCount(SlotType::Medium) == 7; // only the claimed car is left
+    lot.unparkVehicle(ticketId);
+
+    // park cost with and without 100k holds pending on another slot type, deadlines spread over the next day
+    const int holds = 100000;
+    const int operations = 200000;
+    for(int i = 0; i < holds; i++) lot.addParkingSlot(0, SlotType::Small);
+    auto measurePark = [&lot, operations](){
+        auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < operations; i++){
+            TicketId parked = lot.parkVehicle("RS-PARK", VehicleType::Car, 0);
+            if(parked != -1) lot.unparkVehicle(parked);
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / operations;
+    };
+    double withoutHolds = measurePark();
+    const TimePoint holdStart = clock -> now();
+    for(int i = 0; i < holds; i++){
+        lot.reserveSlot(0, "H-" + std::to_string(i), SlotType::Small, holdStart + std::chrono::seconds(60 + i % 86400));
+    }
+    double withHolds = measurePark();
+    ok = ok && heldCount() == holds;
+
+    // 1.7e11 ticks to catch up on, with one hold pending from before the jump and one made after it
+    auto replayClock = std::make_shared<VirtualClock>();
+    ShardedParkingLotSystem replayLot(1, tick);
+    replayLot.setClock(replayClock);
+    for(int i = 0; i < 4; i++) replayLot.addParkingSlot(0, SlotType::Medium);
+    ReservationId beforeJump = replayLot.reserveSlot(0, "RJ-OLD", SlotType::Medium, replayClock -> now() + std::chrono::minutes(5));
+    replayClock -> set(TimePoint(std::chrono::seconds(1700000000)));
+    settle();
+    auto reserveStart = std::chrono::steady_clock::now();
+    ReservationId afterJump = replayLot.reserveSlot(0, "RJ-NEW", SlotType::Medium, replayClock -> now() + std::chrono::minutes(5));
+    double reserveMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - reserveStart).count();
+    bool jumpOk = beforeJump != -1 && afterJump != -1 && replayLot.getHeldCount(0) == 1 && reserveMillis < 50;
+    replayClock -> set(replayClock -> now() + std::chrono::minutes(4));
+    settle();
+    jumpOk = jumpOk && replayLot.getHeldCount(0) == 1;
+    replayClock -> set(replayClock -> now() + std::chrono::minutes(2));
+    settle();
+    jumpOk = jumpOk && replayLot.getHeldCount(0) == 0;
+    ok = ok && jumpOk;
+
+    std::cout << "Reservations: claim/expiry checks " << (ok ? "pass" : "FAIL") << ", park+unpark " << withoutHolds
+              << " ns without holds, " << withHolds << " ns with " << holds << " holds pending, reserve after a 1.7e9 s clock jump "
+              << reserveMillis << " ms\n";
+    return ok;
+}
+
+int main() {
+
+    int failedChecks = 0;
+    if(!runFreeSlotIndexCheck()) failedChecks++;
+    if(!runNearestToGateCheck()) failedChecks++;
+    if(!runAtomicSlotManagerStressTest()) failedChecks++;
+    if(!runTariffEdgeCaseCheck()) failedChecks++;
+    runShardedParkingThroughputDemo();
+    runSlotManagerPolicyBenchmark();
+    runParkingLoadBenchmarks(LoadBenchmarkConfig{});
+    runTraceReplayDemo();
+    if(!runOccupancyEventBusDemo()) failedChecks++;
+    if(!runOccupancyAnalyticsDemo()) failedChecks++;
+    runCoarseClockParkingDemo();
+    if(!runJournalRecoveryDemo()) failedChecks++;
+    if(!runReservationDemo()) failedChecks++;
 
-    return 0;
+    return failedChecks == 0 ? 0 : 1;
 }
\ No newline at end of file
@@ -1,27 +1,967 @@
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <unordered_map>
 #include <mutex>
 #include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <shared_mutex>
+#include <array>
+#include <random>
+#include <cmath>
+#include <future>
+#include <deque>
+#include <queue>
+#include <functional>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <new>
+#include <fcntl.h>    // O_CREAT
+#include <sys/mman.h> // shm_open, mmap
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>   // fork, ftruncate
+
+#include "../Common/ClockSource.h"
+
+// PerClientMutex: the original map mutex + per-client mutex design.
+// LockFree: the window start (coarse ticks) and the counter share one 64-bit atomic, a decision is one load + one CAS.
+enum class RateLimiterMode{PerClientMutex, LockFree};
+
+// Limiters read steady_clock::now() directly unless given one of these, e.g. a CoarseClock to take clock reads
+// off the per-request path or a ManualClock in tests
+using SteadyClockSource = ClockSource<std::chrono::steady_clock>;
+
+// Per-client state each algorithm adds on top of the shared ClientState/map node (~100 bytes):
+//   FixedWindow           12 bytes (mutex mode) or the 8-byte packed word. Lets up to 2x the limit through around a boundary.
+//   SlidingWindowCounter  the 8-byte packed word: window index + previous and current counts, lock-free.
+//                         Approximates a true sliding window by weighting the previous window by how much of it still overlaps.
+//   SlidingWindowLog      8 bytes per request allowed in a window (a ring of limit timestamps, allocated on first use)
+//                         + 16 bytes of bookkeeping, under the client mutex. Exact, but memory grows with the limit.
+//   TokenBucket           the 8-byte word as a GCRA theoretical arrival time, lock-free. Allows a burst of limit
+//                         and then one request every windowSize / limit.
+// Pick per route by giving each route its own RateLimiter.
+enum class RateLimitAlgorithm{FixedWindow, SlidingWindowCounter, SlidingWindowLog, TokenBucket};
 
 struct ClientState{
-    std::chrono::steady_clock::time_point windowStartTime = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point windowStartTime{}; // long ago, so the first request opens a window on whichever clock is in use
     int requestsCounter = 0;
     std::mutex clientMtx;
+
+    // FixedWindow LockFree: [window start tick : 40][requests in window : 24]
+    // SlidingWindowCounter:  [window index : 28][previous window count : 18][current window count : 18]
+    // TokenBucket:           theoretical arrival time, nanoseconds since the limiter's epoch
+    std::atomic<std::uint64_t> packedWindow{0};
+
+    // SlidingWindowLog only, under clientMtx: ticks of the last allowed requests, requestLog[requestLogHead] is the oldest
+    std::unique_ptr<std::uint64_t[]> requestLog;
+    std::uint32_t requestLogHead = 0;
+    std::uint32_t requestLogSize = 0;
+    std::uint32_t requestLogCapacity = 0;
+
+    // Seconds since the limiter's epoch of the last request, drives idle eviction
+    std::atomic<std::uint32_t> lastSeenSecond{0};
+};
+
+// idleTtl: clients not seen for longer are dropped. Default (0) is 2 * windowSize, which loses nothing: after that
+// long every algorithm's state is equivalent to a brand-new client's.
+// maxTrackedClients: 0 is unlimited. Enforced per shard (max / shardCount each, rounded down, and fewer shards when max
+// is below shardCount), so the table never holds more than max; a new client in a full shard
+// replaces the least recently seen of a few sampled entries, which merely restarts that client's limit.
+struct ClientEvictionPolicy{
+    std::chrono::seconds idleTtl{0};
+    std::size_t maxTrackedClients = 0;
+};
+
+struct ClientTableStats{
+    std::size_t trackedClients = 0;
+    std::uint64_t evictedIdle = 0;
+    std::uint64_t evictedForCapacity = 0;
+    std::size_t approximateBytes = 0; // map nodes + bucket arrays + SlidingWindowLog rings
+};
+
+// Client id -> ClientState split over a power-of-two number of shards, each behind its own shared_mutex.
+// Clients already seen are used under a shared lock, so they never serialize with each other; only a first-time
+// insert takes its shard exclusively. The shard lock is held for the whole decision, so eviction (exclusive) can never
+// free a ClientState another thread is still using.
+// Eviction is incremental: every insert, which already holds the exclusive lock, sweeps a few buckets of its shard.
+// evictIdleClients() sweeps everything for callers that want a periodic full pass.
+class ClientTable{
+    static constexpr std::size_t SWEEP_BUCKETS_PER_INSERT = 4;
+    static constexpr int CAPACITY_EVICTION_SAMPLES = 8;
+
+    struct alignas(64) Shard{
+        std::shared_mutex mtx;
+        std::unordered_map<int, ClientState> clients;
+        std::size_t sweepCursor = 0; // next bucket to sweep, under the exclusive lock
+        std::uint64_t evictedIdle = 0;
+        std::uint64_t evictedForCapacity = 0;
+    };
+
+    const std::size_t shardMask;
+    std::unique_ptr<Shard[]> shards;
+    std::uint32_t idleTtlSeconds = 0;
+    std::size_t maxClientsPerShard = 0; // 0 = unlimited
+
+    // withClients' working arrays, kept per thread so a batch doesn't allocate once they've grown to the batch size
+    struct BatchScratch{
+        std::vector<std::uint32_t> shardStart;
+        std::vector<std::uint32_t> fill;
+        std::vector<std::uint32_t> shardOfPosition;
+        std::vector<std::uint32_t> positions;
+        std::vector<std::uint32_t> missing;
+    };
+
+    static BatchScratch& batchScratch(){
+        static thread_local BatchScratch scratch;
+        return scratch;
+    }
+
+    static std::size_t roundUpToPowerOfTwo(std::size_t value){
+        std::size_t result = 1;
+        while(result < value) result <<= 1;
+        return result;
+    }
+
+    // Power of two, and no more shards than the cap allows one client each, so per-shard caps never add up past it
+    static std::size_t shardCountFor(std::size_t shardCount, std::size_t maxTrackedClients){
+        std::size_t count = roundUpToPowerOfTwo(std::max<std::size_t>(1, shardCount));
+        while(maxTrackedClients != 0 && count > maxTrackedClients) count >>= 1;
+        return count;
+    }
+
+    // Fibonacci hashing, so sequential ids don't all land in neighbouring shards
+    Shard& shardOf(int clientId){
+        std::uint64_t hash = static_cast<std::uint64_t>(static_cast<std::uint32_t>(clientId)) * 0x9E3779B97F4A7C15ull;
+        return shards[(hash >> 32) & shardMask];
+    }
+
+    bool isIdle(const ClientState& client, std::uint32_t nowSecond) const{
+        // a second later than ours was stamped by a thread with a newer clock read: seen just now, not long ago
+        std::uint32_t lastSeen = client.lastSeenSecond.load(std::memory_order_relaxed);
+        return lastSeen <= nowSecond && nowSecond - lastSeen > idleTtlSeconds;
+    }
+
+    // Under the shard's exclusive lock. Erasing doesn't rehash, so bucket indices stay valid while sweeping.
+    void sweepBuckets(Shard& shard, std::size_t bucketCount, std::uint32_t nowSecond){
+        std::vector<int> idleClients;
+        for(std::size_t i = 0; i < bucketCount; i++){
+            std::size_t bucket = shard.sweepCursor++ % shard.clients.bucket_count();
+            for(auto it = shard.clients.begin(bucket); it != shard.clients.end(bucket); ++it){
+                if(isIdle(it -> second, nowSecond)) idleClients.push_back(it -> first);
+            }
+        }
+        for(int clientId : idleClients) shard.clients.erase(clientId);
+        shard.evictedIdle += idleClients.size();
+    }
+
+    // Under the exclusive lock, shard is at its cap: drop the stalest of a few entries near the sweep cursor
+    void evictForCapacity(Shard& shard){
+        auto victim = shard.clients.end();
+        std::size_t bucket = shard.sweepCursor % shard.clients.bucket_count();
+        for(int sampled = 0; sampled < CAPACITY_EVICTION_SAMPLES;){
+            for(auto it = shard.clients.begin(bucket); it != shard.clients.end(bucket) && sampled < CAPACITY_EVICTION_SAMPLES; ++it, ++sampled){
+                auto candidate = shard.clients.find(it -> first);
+                if(victim == shard.clients.end()
+                    || candidate -> second.lastSeenSecond.load(std::memory_order_relaxed) < victim -> second.lastSeenSecond.load(std::memory_order_relaxed)){
+                    victim = candidate;
+                }
+            }
+            bucket = (bucket + 1) % shard.clients.bucket_count();
+            if(bucket == shard.sweepCursor % shard.clients.bucket_count()) break; // wrapped, fewer entries than samples
+        }
+        shard.sweepCursor = bucket;
+        if(victim == shard.clients.end()) return;
+        shard.clients.erase(victim);
+        shard.evictedForCapacity++;
+    }
+
+public:
+    ClientTable(std::size_t shardCount, std::uint32_t idleTtlSeconds, std::size_t maxTrackedClients) :
+        shardMask(shardCountFor(shardCount, maxTrackedClients) - 1),
+        shards(std::make_unique<Shard[]>(shardMask + 1)),
+        idleTtlSeconds(idleTtlSeconds),
+        maxClientsPerShard(maxTrackedClients / (shardMask + 1)){} // rounded down, 0 stays unlimited
+
+    // Runs decide(ClientState&) with the client's shard locked (shared, or exclusive on first sight) and returns its result.
+    // nowSecond is the caller's coarse clock, it stamps the client as recently seen.
+    template<typename Decide>
+    auto withClient(int clientId, std::uint32_t nowSecond, Decide&& decide){
+        Shard& shard = shardOf(clientId);
+        {
+            std::shared_lock<std::shared_mutex> readGuard(shard.mtx);
+            auto it = shard.clients.find(clientId);
+            if(it != shard.clients.end()){
+                ClientState& client = it -> second;
+                // only written when the second changes, repeat requests leave the line clean
+                if(client.lastSeenSecond.load(std::memory_order_relaxed) != nowSecond) client.lastSeenSecond.store(nowSecond, std::memory_order_relaxed);
+                return decide(client);
+            }
+        }
+        std::lock_guard<std::shared_mutex> writeGuard(shard.mtx);
+        // ClientState holds a mutex, so it can't be moved into the map: default-construct it in place.
+        // Another thread may have inserted it between the two locks, try_emplace then just finds it.
+        auto it = shard.clients.find(clientId);
+        if(it == shard.clients.end()){
+            if(!shard.clients.empty()) sweepBuckets(shard, SWEEP_BUCKETS_PER_INSERT, nowSecond);
+            if(maxClientsPerShard != 0 && shard.clients.size() >= maxClientsPerShard) evictForCapacity(shard);
+            it = shard.clients.try_emplace(clientId).first;
+        }
+        it -> second.lastSeenSecond.store(nowSecond, std::memory_order_relaxed);
+        return decide(it -> second);
+    }
+
+    // Batch form of withClient. decide(ClientState&, const std::uint32_t* positions, std::size_t runLength) is called once
+    // per distinct client with the batch positions of all its requests, in batch order. Positions are grouped by shard
+    // (counting sort), each shard is locked shared once for the clients it has and exclusively once for the ones it doesn't.
+    template<typename DecideRun>
+    void withClients(const int* clientIds, std::size_t count, std::uint32_t nowSecond, DecideRun&& decide){
+        const std::size_t shardCount = shardMask + 1;
+        BatchScratch& scratch = batchScratch();
+        std::vector<std::uint32_t>& shardStart = scratch.shardStart;
+        std::vector<std::uint32_t>& shardOfPosition = scratch.shardOfPosition;
+        std::vector<std::uint32_t>& positions = scratch.positions;
+        std::vector<std::uint32_t>& fill = scratch.fill;
+        std::vector<std::uint32_t>& missing = scratch.missing;
+        shardStart.assign(shardCount + 1, 0);
+        shardOfPosition.resize(count);
+        for(std::size_t i = 0; i < count; i++){
+            shardOfPosition[i] = static_cast<std::uint32_t>(&shardOf(clientIds[i]) - shards.get());
+            shardStart[shardOfPosition[i] + 1]++;
+        }
+        for(std::size_t shard = 0; shard < shardCount; shard++) shardStart[shard + 1] += shardStart[shard];
+        positions.resize(count);
+        fill.assign(shardStart.begin(), shardStart.end() - 1);
+        for(std::size_t i = 0; i < count; i++) positions[fill[shardOfPosition[i]]++] = static_cast<std::uint32_t>(i);
+
+        for(std::size_t shardIndex = 0; shardIndex < shardCount; shardIndex++){
+            std::uint32_t* begin = positions.data() + shardStart[shardIndex];
+            std::uint32_t* end = positions.data() + shardStart[shardIndex + 1];
+            if(begin == end) continue;
+            // runs of the same client, batch order kept inside each run
+            std::stable_sort(begin, end, [clientIds](std::uint32_t a, std::uint32_t b){ return clientIds[a] < clientIds[b]; });
+            Shard& shard = shards[shardIndex];
+            missing.clear();
+            {
+                std::shared_lock<std::shared_mutex> readGuard(shard.mtx);
+                for(std::uint32_t* run = begin; run != end;){
+                    std::uint32_t* runEnd = run + 1;
+                    while(runEnd != end && clientIds[*runEnd] == clientIds[*run]) runEnd++;
+                    auto it = shard.clients.find(clientIds[*run]);
+                    if(it == shard.clients.end()) missing.insert(missing.end(), run, runEnd);
+                    else{
+                        if(it -> second.lastSeenSecond.load(std::memory_order_relaxed) != nowSecond) it -> second.lastSeenSecond.store(nowSecond, std::memory_order_relaxed);
+                        decide(it -> second, run, static_cast<std::size_t>(runEnd - run));
+                    }
+                    run = runEnd;
+                }
+            }
+            if(missing.empty()) continue;
+
+            std::lock_guard<std::shared_mutex> writeGuard(shard.mtx);
+            for(std::size_t run = 0; run < missing.size();){
+                std::size_t runEnd = run + 1;
+                while(runEnd < missing.size() && clientIds[missing[runEnd]] == clientIds[missing[run]]) runEnd++;
+                int clientId = clientIds[missing[run]];
+                auto it = shard.clients.find(clientId);
+                if(it == shard.clients.end()){
+                    if(!shard.clients.empty()) sweepBuckets(shard, SWEEP_BUCKETS_PER_INSERT, nowSecond);
+                    if(maxClientsPerShard != 0 && shard.clients.size() >= maxClientsPerShard) evictForCapacity(shard);
+                    it = shard.clients.try_emplace(clientId).first;
+                }
+                it -> second.lastSeenSecond.store(nowSecond, std::memory_order_relaxed);
+                decide(it -> second, missing.data() + run, runEnd - run);
+                run = runEnd;
+            }
+        }
+    }
+
+    // Full pass over every shard, one shard locked at a time. Returns how many clients were dropped.
+    std::size_t evictIdleClients(std::uint32_t nowSecond){
+        std::size_t evicted = 0;
+        for(std::size_t i = 0; i <= shardMask; i++){
+            std::lock_guard<std::shared_mutex> writeGuard(shards[i].mtx);
+            std::uint64_t before = shards[i].evictedIdle;
+            sweepBuckets(shards[i], shards[i].clients.bucket_count(), nowSecond);
+            evicted += shards[i].evictedIdle - before;
+        }
+        return evicted;
+    }
+
+    ClientTableStats getStats(){
+        ClientTableStats stats;
+        for(std::size_t i = 0; i <= shardMask; i++){
+            std::shared_lock<std::shared_mutex> readGuard(shards[i].mtx);
+            const auto& clients = shards[i].clients;
+            stats.trackedClients += clients.size();
+            stats.evictedIdle += shards[i].evictedIdle;
+            stats.evictedForCapacity += shards[i].evictedForCapacity;
+            // node = value + next pointer + cached hash (libstdc++ doesn't cache it for int keys, but close enough)
+            stats.approximateBytes += clients.size() * (sizeof(std::pair<const int, ClientState>) + 2 * sizeof(void*))
+                + clients.bucket_count() * sizeof(void*);
+            for(const auto& [clientId, client] : clients){
+                if(client.requestLog) stats.approximateBytes += client.requestLogCapacity * sizeof(std::uint64_t);
+            }
+        }
+        return stats;
+    }
+
+    std::size_t getShardCount() const{
+        return shardMask + 1;
+    }
+};
+
+// One limit kept in a single atomic word and decided with a load + CAS loop: the fixed window
+// ([window start tick : 40][requests in window : 24], ticks are milliseconds) or GCRA (the theoretical arrival time
+// in nanoseconds). Shared by RateLimiter's lock-free paths and by every level of HierarchicalRateLimiter.
+// tryAcquire reports what it took so release() can hand the request back when a later level rejects.
+class PackedWindowRule{
+    static constexpr int COUNTER_BITS = 24;
+    static constexpr std::uint64_t COUNTER_MASK = (std::uint64_t{1} << COUNTER_BITS) - 1;
+    static constexpr std::uint64_t NANOS_PER_TICK = 1000000;
+
+    RateLimitAlgorithm algorithm; // FixedWindow or TokenBucket
+    std::uint64_t maxRequests;
+    std::uint64_t windowTicks;
+    std::uint64_t emissionInterval;
+    std::uint64_t burstTolerance;
+
+public:
+    static constexpr std::uint64_t MAX_REQUESTS = COUNTER_MASK; // the packed counter saturates at the limit
+
+    PackedWindowRule(std::chrono::nanoseconds windowSize, std::uint64_t maxRequestsPerWindow, RateLimitAlgorithm algorithm) :
+        algorithm(algorithm == RateLimitAlgorithm::TokenBucket ? algorithm : RateLimitAlgorithm::FixedWindow),
+        maxRequests(std::max<std::uint64_t>(1, std::min(maxRequestsPerWindow, MAX_REQUESTS))),
+        windowTicks(std::max<std::uint64_t>(1, windowSize.count() / NANOS_PER_TICK)),
+        emissionInterval(std::max<std::uint64_t>(1, windowSize.count() / maxRequests)),
+        burstTolerance(emissionInterval * (maxRequests - 1)){}
+
+    // nowNanos counts from the owner's epoch. False when the limit is reached.
+    bool tryAcquire(std::atomic<std::uint64_t>& word, std::uint64_t nowNanos, std::uint64_t& taken) const{
+        std::uint64_t current = word.load(std::memory_order_relaxed);
+        if(algorithm == RateLimitAlgorithm::TokenBucket){
+            // GCRA: a request costs emissionInterval of theoretical arrival time (TAT) and is allowed while TAT is at most
+            // limit - 1 intervals ahead of now: a burst of limit, then one every windowSize / limit
+            while(true){
+                std::uint64_t start = std::max(current, nowNanos);
+                if(start - nowNanos > burstTolerance) return false;
+                taken = start + emissionInterval;
+                if(word.compare_exchange_weak(current, taken, std::memory_order_relaxed)) return true;
+            }
+        }
+
+        // Same fixed window semantics as the mutex path. The counter stops at the limit, so once a client is over its
+        // limit every further request in the window is rejected by the load alone, without writing the shared cache line.
+        const std::uint64_t nowTick = nowNanos / NANOS_PER_TICK;
+        while(true){
+            std::uint64_t windowStartTick = current >> COUNTER_BITS;
+            std::uint64_t requestsCounter = current & COUNTER_MASK;
+            std::uint64_t next;
+            // a window started after our clock read (another thread read later and got there first) is the current one
+            if(windowStartTick <= nowTick && nowTick - windowStartTick >= windowTicks) next = (nowTick << COUNTER_BITS) | 1; // a new window, this request is its first
+            else if(requestsCounter >= maxRequests) return false;
+            else next = current + 1;
+
+            // on failure current is reloaded and the decision is redone against the winner's state
+            if(word.compare_exchange_weak(current, next, std::memory_order_relaxed)){
+                taken = next >> COUNTER_BITS;
+                return true;
+            }
+        }
+    }
+
+    // True when a word holding this value would behave like a fresh client at nowNanos
+    bool isIdle(std::uint64_t value, std::uint64_t nowNanos) const{
+        if(algorithm == RateLimitAlgorithm::TokenBucket) return value <= nowNanos;
+        // a window started after our clock read is the current one, not an old one
+        const std::uint64_t nowTick = nowNanos / NANOS_PER_TICK;
+        return (value >> COUNTER_BITS) <= nowTick && nowTick - (value >> COUNTER_BITS) >= windowTicks;
+    }
+
+    // Nanoseconds since the owner's epoch at which a word holding this value admits its next request (nowNanos if now)
+    std::uint64_t earliestAdmission(std::uint64_t value, std::uint64_t nowNanos) const{
+        if(algorithm == RateLimitAlgorithm::TokenBucket){
+            std::uint64_t start = std::max(value, nowNanos);
+            return start - nowNanos > burstTolerance ? start - burstTolerance : nowNanos;
+        }
+        const std::uint64_t nowTick = nowNanos / NANOS_PER_TICK;
+        std::uint64_t windowStartTick = value >> COUNTER_BITS;
+        bool windowOver = windowStartTick <= nowTick && nowTick - windowStartTick >= windowTicks; // as in tryAcquire
+        if(windowOver || (value & COUNTER_MASK) < maxRequests) return nowNanos;
+        return (windowStartTick + windowTicks) * NANOS_PER_TICK;
+    }
+
+    // Undo one successful tryAcquire. A window that has rolled over since needs nothing undone.
+    void release(std::atomic<std::uint64_t>& word, std::uint64_t taken) const{
+        std::uint64_t current = word.load(std::memory_order_relaxed);
+        while(true){
+            std::uint64_t next;
+            if(algorithm == RateLimitAlgorithm::TokenBucket){
+                if(current < emissionInterval) return;
+                next = current - emissionInterval; // later requests may have pushed TAT on, giving one interval back is still exact
+            }
+            else{
+                if((current >> COUNTER_BITS) != taken || (current & COUNTER_MASK) == 0) return;
+                next = current - 1;
+            }
+            if(word.compare_exchange_weak(current, next, std::memory_order_relaxed)) return;
+        }
+    }
+};
+
+// -------- Cross-process limiter --------
+
+struct SharedLimiterStats{
+    std::size_t capacity = 0;
+    std::size_t usedSlots = 0;
+    std::uint64_t reclaimedSlots = 0;      // idle clients whose slot went to a new client
+    std::uint64_t tableFullRejections = 0; // requests rejected because no slot could be found for the client
+};
+
+// One limit for every process on the host: client windows live in a POSIX shared-memory segment that each worker maps
+// by name, instead of in each process's own ClientTable. The segment is a header plus an open-addressing table of
+// 16-byte slots {key, packed window word}, both plain 64-bit atomics, so every decision is the same load + CAS as
+// RateLimiterMode::LockFree (FixedWindow or TokenBucket, other algorithms fall back to FixedWindow).
+// Crash tolerance: nothing is ever locked. Claiming a slot, reclaiming it and taking a request are each a single CAS,
+// so a worker killed at any point leaves every slot valid; at worst the request it was deciding is counted.
+// Initialisation is claimed by CAS-ing (pid, INITIALISING) into the header, a later opener that finds that pid dead
+// starts it over. The segment outlives its processes (restarted workers keep the windows) until unlink().
+// Slots are never freed: when a client's probe run is full, the first slot whose window has expired is handed over
+// to it. The hand-over parks the key on (RECLAIMING, pid), resets the word from the idle value it saw to 0 and only then
+// publishes the new key, so the new owner starts from a fresh window; if the old owner touched the word in between,
+// the key goes back. A worker that looked the slot up before the hand-over re-reads the key after deciding and takes
+// back a request it charged to someone else. A reclaimer that dies mid hand-over is finished by the next prober.
+class SharedMemoryRateLimiter{
+    static constexpr std::uint64_t MAGIC = 0x524C494D53484D31ull; // "RLIMSHM1"
+    static constexpr std::uint64_t STATE_INITIALISING = 1;
+    static constexpr std::uint64_t STATE_READY = 2;
+    static constexpr std::size_t MAX_PROBE = 32;
+    static constexpr std::uint64_t RECLAIMING = std::uint64_t{1} << 63; // key | pid while a slot changes hands
+    static constexpr int MAX_DECISION_ATTEMPTS = 4;
+
+    struct Header{
+        std::atomic<std::uint64_t> initState; // [pid : 62][state : 2], 0 = nobody has started
+        std::uint64_t magic;
+        std::uint64_t windowNanos;
+        std::uint64_t maxRequestsPerWindow;
+        std::uint64_t algorithm;
+        std::uint64_t capacity;
+        std::uint64_t epochNanos; // steady_clock (CLOCK_MONOTONIC) is the same clock in every process on the host
+        alignas(64) std::atomic<std::uint64_t> reclaimedSlots;
+        std::atomic<std::uint64_t> tableFullRejections;
+    };
+
+    struct alignas(16) Slot{
+        std::atomic<std::uint64_t> key;  // clientId + 1, 0 = empty, RECLAIMING | pid mid hand-over
+        std::atomic<std::uint64_t> word; // PackedWindowRule state, 0 is a fresh window
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "slots must be address-free atomics to be shared");
+
+    std::string name;
+    std::size_t capacity;
+    std::size_t mappedBytes = 0;
+    void* mapping = nullptr;
+    Header* header = nullptr;
+    Slot* slots = nullptr;
+    PackedWindowRule packedRule;
+
+    static std::size_t mappingSize(std::size_t capacity){
+        return sizeof(Header) + capacity * sizeof(Slot);
+    }
+
+    static bool processAlive(std::uint64_t pid){
+        return pid != 0 && (::kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH);
+    }
+
+    // Exactly one process initialises; everyone else waits for READY, or takes over from an initialiser that died
+    bool initialiseOrWait(std::chrono::nanoseconds windowSize, std::uint64_t maxRequestsPerWindow, RateLimitAlgorithm algorithm){
+        const std::uint64_t mine = (static_cast<std::uint64_t>(::getpid()) << 2) | STATE_INITIALISING;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while(true){
+            std::uint64_t state = header -> initState.load(std::memory_order_acquire);
+            if((state & 3) == STATE_READY) break;
+            if(state == 0 || !processAlive(state >> 2)){
+                if(!header -> initState.compare_exchange_strong(state, mine, std::memory_order_acq_rel)) continue;
+                header -> magic = MAGIC;
+                header -> windowNanos = static_cast<std::uint64_t>(windowSize.count());
+                header -> maxRequestsPerWindow = maxRequestsPerWindow;
+                header -> algorithm = static_cast<std::uint64_t>(algorithm);
+                header -> capacity = capacity;
+                header -> epochNanos = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+                header -> initState.store((mine & ~std::uint64_t{3}) | STATE_READY, std::memory_order_release);
+                break;
+            }
+            if(std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        // every process must agree on the limit, or they would each enforce their own
+        return header -> magic == MAGIC && header -> capacity == capacity &&
+               header -> windowNanos == static_cast<std::uint64_t>(windowSize.count()) &&
+               header -> maxRequestsPerWindow == maxRequestsPerWindow &&
+               header -> algorithm == static_cast<std::uint64_t>(algorithm);
+    }
+
+    std::uint64_t nowNanos() const{
+        std::uint64_t now = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        return now > header -> epochNanos ? now - header -> epochNanos : 0;
+    }
+
+    // Gives slot (key seen as expectedKey) to key. The word must still hold the idle value read before the claim: it is
+    // reset to 0 under the RECLAIMING key, and the fence pairs with the one in allowRequest so that a worker still
+    // deciding on the old key either shows up here as a changed word or sees the key change and gives its request back.
+    bool handOver(Slot& slot, std::uint64_t expectedKey, std::uint64_t key, std::uint64_t now){
+        const std::uint64_t reclaiming = RECLAIMING | static_cast<std::uint64_t>(::getpid());
+        const bool finishingDeadReclaimer = (expectedKey & RECLAIMING) != 0;
+        std::uint64_t idleValue = slot.word.load(std::memory_order_relaxed);
+        if(!finishingDeadReclaimer && !packedRule.isIdle(idleValue, now)) return false;
+        if(!slot.key.compare_exchange_strong(expectedKey, reclaiming, std::memory_order_acq_rel)) return false;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(finishingDeadReclaimer) slot.word.store(0, std::memory_order_relaxed);
+        else if(!slot.word.compare_exchange_strong(idleValue, 0, std::memory_order_relaxed)){
+            slot.key.store(expectedKey, std::memory_order_release); // the old owner is back, leave it its slot
+            return false;
+        }
+        slot.key.store(key, std::memory_order_release);
+        header -> reclaimedSlots.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Waits out another process's hand-over of this slot. Returns the key it settled on, or a dead reclaimer's key.
+    std::uint64_t settledKey(Slot& slot){
+        std::uint64_t current = slot.key.load(std::memory_order_acquire);
+        for(int spins = 0; (current & RECLAIMING) != 0 && processAlive(current & ~RECLAIMING); spins++){
+            if(spins > 1000) std::this_thread::sleep_for(std::chrono::microseconds(50));
+            else std::this_thread::yield();
+            current = slot.key.load(std::memory_order_acquire);
+        }
+        return current;
+    }
+
+    // The client's slot, claiming or reclaiming one if needed. nullptr when the whole probe run is busy.
+    Slot* findSlot(int clientId, std::uint64_t now){
+        const std::uint64_t key = static_cast<std::uint64_t>(static_cast<std::uint32_t>(clientId)) + 1;
+        const std::size_t home = static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) % capacity;
+        const std::size_t probes = std::min(MAX_PROBE, capacity);
+        for(int attempt = 0; attempt < 4; attempt++){
+            for(std::size_t i = 0; i < probes; i++){
+                Slot& slot = slots[(home + i) % capacity];
+                // a slot mid hand-over may be becoming this client's, so wait for it rather than claiming a second one
+                std::uint64_t current = settledKey(slot);
+                if(current == key) return &slot;
+                if(current == 0){
+                    if(slot.key.compare_exchange_strong(current, key, std::memory_order_acq_rel) || current == key) return &slot;
+                }
+            }
+            // no slot of its own and no empty one: take over the first slot whose window is over (or whose reclaimer died)
+            bool changed = false;
+            for(std::size_t i = 0; i < probes && !changed; i++){
+                Slot& slot = slots[(home + i) % capacity];
+                std::uint64_t current = slot.key.load(std::memory_order_acquire);
+                if(current == key) return &slot;
+                if((current & RECLAIMING) != 0 && processAlive(current & ~RECLAIMING)){
+                    changed = true; // someone is mid hand-over, look again from the start
+                    continue;
+                }
+                if(handOver(slot, current, key, now)) return &slot;
+                changed = slot.key.load(std::memory_order_acquire) != current;
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    // Creates the segment or attaches to an existing one with the same limit and capacity. Check isOpen().
+    SharedMemoryRateLimiter(const std::string& name, std::chrono::nanoseconds windowSize, std::uint64_t maxRequestsPerWindow,
+                            RateLimitAlgorithm algorithm = RateLimitAlgorithm::FixedWindow, std::size_t capacity = 1 << 16) :
+        name(name),
+        capacity(std::max<std::size_t>(1, capacity)),
+        packedRule(windowSize, maxRequestsPerWindow, algorithm == RateLimitAlgorithm::TokenBucket ? algorithm : RateLimitAlgorithm::FixedWindow){
+        if(algorithm != RateLimitAlgorithm::TokenBucket) algorithm = RateLimitAlgorithm::FixedWindow;
+        maxRequestsPerWindow = std::max<std::uint64_t>(1, std::min(maxRequestsPerWindow, PackedWindowRule::MAX_REQUESTS));
+
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if(fd < 0) return;
+        const std::size_t size = mappingSize(this -> capacity);
+        struct stat info;
+        bool sized = ::fstat(fd, &info) == 0 &&
+                     (static_cast<std::size_t>(info.st_size) == size || (info.st_size == 0 && ::ftruncate(fd, size) == 0));
+        if(sized){
+            void* mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(mapped != MAP_FAILED){
+                mapping = mapped;
+                mappedBytes = size;
+            }
+        }
+        ::close(fd); // the mapping keeps the segment alive
+        if(!mapping) return;
+
+        // a fresh segment is all zeroes: no init state, every slot empty
+        header = static_cast<Header*>(mapping);
+        slots = reinterpret_cast<Slot*>(static_cast<char*>(mapping) + sizeof(Header));
+        if(!initialiseOrWait(windowSize, maxRequestsPerWindow, algorithm)){
+            ::munmap(mapping, mappedBytes);
+            mapping = nullptr;
+            header = nullptr;
+            slots = nullptr;
+        }
+    }
+
+    SharedMemoryRateLimiter(const SharedMemoryRateLimiter&) = delete;
+    SharedMemoryRateLimiter& operator=(const SharedMemoryRateLimiter&) = delete;
+
+    ~SharedMemoryRateLimiter(){
+        if(mapping) ::munmap(mapping, mappedBytes);
+    }
+
+    bool isOpen() const{
+        return mapping != nullptr;
+    }
+
+    // Removes the name; processes that have it mapped keep working on the old segment
+    static void unlink(const std::string& name){
+        ::shm_unlink(name.c_str());
+    }
+
+    // Crash drill: a forked child creates the segment, claims its initialisation and exits without finishing, as a
+    // worker killed during startup would. The next opener has to take over. False if the child couldn't get that far.
+    static bool abandonInitialisation(const std::string& name, std::size_t capacity){
+        pid_t pid = ::fork();
+        if(pid == 0){
+            int fd = ::shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+            const std::size_t size = mappingSize(std::max<std::size_t>(1, capacity));
+            if(fd < 0 || ::ftruncate(fd, size) != 0) ::_exit(1);
+            void* mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(mapped == MAP_FAILED) ::_exit(1);
+            std::uint64_t expected = 0;
+            const std::uint64_t mine = (static_cast<std::uint64_t>(::getpid()) << 2) | STATE_INITIALISING;
+            ::_exit(static_cast<Header*>(mapped) -> initState.compare_exchange_strong(expected, mine) ? 0 : 1);
+        }
+        int status = 0;
+        return pid > 0 && ::waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    // Fails closed: false when not open or when the client can't get a slot
+    bool allowRequest(int clientId){
+        if(!mapping) return false;
+        const std::uint64_t key = static_cast<std::uint64_t>(static_cast<std::uint32_t>(clientId)) + 1;
+        for(int attempt = 0; attempt < MAX_DECISION_ATTEMPTS; attempt++){
+            const std::uint64_t now = nowNanos();
+            Slot* slot = findSlot(clientId, now);
+            if(!slot){
+                header -> tableFullRejections.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::uint64_t taken;
+            bool allowed = packedRule.tryAcquire(slot -> word, now, taken);
+            // pairs with the fence in handOver: if the slot was handed over meanwhile, the decision was on someone else's window
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(slot -> key.load(std::memory_order_relaxed) == key) return allowed;
+            if(allowed) packedRule.release(slot -> word, taken);
+        }
+        return false;
+    }
+
+    SharedLimiterStats getStats() const{
+        SharedLimiterStats stats;
+        if(!mapping) return stats;
+        stats.capacity = capacity;
+        for(std::size_t i = 0; i < capacity; i++){
+            if(slots[i].key.load(std::memory_order_relaxed) != 0) stats.usedSlots++;
+        }
+        stats.reclaimedSlots = header -> reclaimedSlots.load(std::memory_order_relaxed);
+        stats.tableFullRejections = header -> tableFullRejections.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+// -------- Metrics --------
+
+struct HeavyHitter{
+    int clientId = 0;
+    std::uint64_t requests = 0; // count-min estimate of allowed + rejected, never below the true value
+    std::uint64_t allowed = 0;  // count-min estimates, never below the true value
+    std::uint64_t rejected = 0;
+};
+
+struct RateLimiterMetricsSnapshot{
+    std::uint64_t totalAllowed = 0;
+    std::uint64_t totalRejected = 0;
+    std::uint64_t sketchErrorBound = 0; // a count-min estimate exceeds the truth by at most this (w.p. 1 - e^-depth)
+    std::vector<HeavyHitter> heaviestClients; // by requests, heaviest first
+};
+
+// Who is sending and who is being throttled, in fixed memory however many distinct clients show up:
+// two count-min sketches (allowed, rejected) of SKETCH_DEPTH x SKETCH_WIDTH counters and a table of the
+// TOP_K heaviest clients (~256KB + 256 bytes). Every update is relaxed atomics, no locks.
+// The top-K table packs [estimate : 32][clientId : 32] into one word per slot, the estimate being the client's count-min
+// request count. Slot counts only grow, and a record only touches the table when its estimate beats minSlotCount (a
+// lower bound on the smallest slot), so the long tail costs one extra load. Above it, one record in OFFER_EVERY
+// (by estimate) scans the table: a tracked client raises its slot, an untracked one replaces the smallest. CAS attempts
+// are bounded, a lost race is made up by the client's next offer. Two threads placing the same new client at once can briefly give it two slots; snapshot() folds duplicates.
+class RateLimiterMetrics{
+public:
+    static constexpr int SKETCH_DEPTH = 4;
+    static constexpr int SKETCH_WIDTH_BITS = 12;
+    static constexpr std::size_t SKETCH_WIDTH = std::size_t{1} << SKETCH_WIDTH_BITS;
+    static constexpr int TOP_K = 32;
+
+private:
+    static constexpr std::uint64_t ROW_SEEDS[SKETCH_DEPTH] = {
+        0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull
+    };
+    static constexpr std::uint64_t MAX_SLOT_COUNT = 0xFFFFFFFFull;
+    static constexpr int MAX_OFFER_ATTEMPTS = 4;
+    static constexpr std::uint64_t OFFER_EVERY = 8; // power of two; slots lag the sketch by about this much, snapshot() catches up
+
+    std::unique_ptr<std::atomic<std::uint64_t>[]> allowedSketch;  // [row * SKETCH_WIDTH + column]
+    std::unique_ptr<std::atomic<std::uint64_t>[]> rejectedSketch;
+    alignas(64) std::array<std::atomic<std::uint64_t>, TOP_K> topSlots{};
+    alignas(64) std::atomic<std::uint64_t> minSlotCount{0}; // never above the smallest slot's count, read by every record
+
+    static std::size_t column(int row, int clientId){
+        std::uint64_t hash = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(clientId)) + 1) * ROW_SEEDS[row];
+        return static_cast<std::size_t>(hash >> (64 - SKETCH_WIDTH_BITS));
+    }
+
+    static std::uint64_t estimate(const std::atomic<std::uint64_t>* sketch, int clientId){
+        std::uint64_t smallest = ~std::uint64_t{0};
+        for(int row = 0; row < SKETCH_DEPTH; row++){
+            smallest = std::min(smallest, sketch[row * SKETCH_WIDTH + column(row, clientId)].load(std::memory_order_relaxed));
+        }
+        return smallest;
+    }
+
+    // requests is the client's sketch estimate, already known to be above minSlotCount
+    void offerToTopK(int clientId, std::uint64_t requests){
+        const std::uint64_t id = static_cast<std::uint32_t>(clientId);
+        const std::uint64_t offered = (std::min(requests, MAX_SLOT_COUNT) << 32) | id;
+        for(int attempt = 0; attempt < MAX_OFFER_ATTEMPTS; attempt++){
+            int smallestSlot = -1;
+            std::uint64_t smallestValue = ~std::uint64_t{0};
+            std::uint64_t secondSmallestCount = ~std::uint64_t{0};
+            for(int slot = 0; slot < TOP_K; slot++){
+                std::uint64_t value = topSlots[slot].load(std::memory_order_relaxed);
+                if((value >> 32) != 0 && (value & 0xFFFFFFFFull) == id){
+                    // tracked: raise the slot to the new estimate, unless it has been raised further or handed to another client
+                    for(int raise = 0; raise < MAX_OFFER_ATTEMPTS; raise++){
+                        if((value & 0xFFFFFFFFull) != id || value >= offered) return;
+                        if(topSlots[slot].compare_exchange_weak(value, offered, std::memory_order_relaxed)) return;
+                    }
+                    return;
+                }
+                if(smallestSlot == -1 || value < smallestValue){
+                    secondSmallestCount = std::min(secondSmallestCount, smallestValue >> 32);
+                    smallestSlot = slot;
+                    smallestValue = value;
+                } else{
+                    secondSmallestCount = std::min(secondSmallestCount, value >> 32);
+                }
+            }
+            if((offered >> 32) <= (smallestValue >> 32)) return; // the table moved past this client since minSlotCount was read
+            if(topSlots[smallestSlot].compare_exchange_strong(smallestValue, offered, std::memory_order_relaxed)){
+                // slots only grow, so what this scan saw is still a lower bound
+                minSlotCount.store(std::min(secondSmallestCount, offered >> 32), std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+public:
+    RateLimiterMetrics() :
+        allowedSketch(std::make_unique<std::atomic<std::uint64_t>[]>(SKETCH_DEPTH * SKETCH_WIDTH)),
+        rejectedSketch(std::make_unique<std::atomic<std::uint64_t>[]>(SKETCH_DEPTH * SKETCH_WIDTH)){}
+
+    RateLimiterMetrics(const RateLimiterMetrics&) = delete;
+    RateLimiterMetrics& operator=(const RateLimiterMetrics&) = delete;
+
+    void record(int clientId, bool allowed){
+        std::atomic<std::uint64_t>* sketch = allowed ? allowedSketch.get() : rejectedSketch.get();
+        std::uint64_t requests = ~std::uint64_t{0};
+        for(int row = 0; row < SKETCH_DEPTH; row++){
+            requests = std::min(requests, sketch[row * SKETCH_WIDTH + column(row, clientId)].fetch_add(1, std::memory_order_relaxed) + 1);
+        }
+        requests += estimate(allowed ? rejectedSketch.get() : allowedSketch.get(), clientId);
+        if(requests > minSlotCount.load(std::memory_order_relaxed) && (requests & (OFFER_EVERY - 1)) == 0) offerToTopK(clientId, requests);
+    }
+
+    std::uint64_t estimateAllowed(int clientId) const{
+        return estimate(allowedSketch.get(), clientId);
+    }
+
+    std::uint64_t estimateRejected(int clientId) const{
+        return estimate(rejectedSketch.get(), clientId);
+    }
+
+    // Reads while recorders keep going, so totals and per-client numbers can be a few updates apart
+    RateLimiterMetricsSnapshot snapshot() const{
+        RateLimiterMetricsSnapshot result;
+        for(std::size_t column = 0; column < SKETCH_WIDTH; column++){ // every row sums to the total, row 0 will do
+            result.totalAllowed += allowedSketch[column].load(std::memory_order_relaxed);
+            result.totalRejected += rejectedSketch[column].load(std::memory_order_relaxed);
+        }
+        // count-min bound: e * N / width
+        result.sketchErrorBound = static_cast<std::uint64_t>(2.718281828 * (result.totalAllowed + result.totalRejected) / SKETCH_WIDTH);
+
+        for(const auto& slot : topSlots){
+            std::uint64_t value = slot.load(std::memory_order_relaxed);
+            if((value >> 32) == 0) continue;
+            int clientId = static_cast<int>(static_cast<std::uint32_t>(value & 0xFFFFFFFFull));
+            auto duplicate = std::find_if(result.heaviestClients.begin(), result.heaviestClients.end(),
+                [clientId](const HeavyHitter& hitter){ return hitter.clientId == clientId; });
+            if(duplicate != result.heaviestClients.end()){
+                duplicate -> requests = std::max(duplicate -> requests, value >> 32);
+                continue;
+            }
+            HeavyHitter hitter;
+            hitter.clientId = clientId;
+            hitter.allowed = estimateAllowed(clientId);
+            hitter.rejected = estimateRejected(clientId);
+            hitter.requests = std::max(value >> 32, hitter.allowed + hitter.rejected);
+            result.heaviestClients.push_back(hitter);
+        }
+        std::sort(result.heaviestClients.begin(), result.heaviestClients.end(),
+            [](const HeavyHitter& a, const HeavyHitter& b){ return a.requests > b.requests; });
+        return result;
+    }
 };
 
 class RateLimiter{
+    // The clock read once per call (or once per batch) and handed to every decision made with it
+    struct RequestTime{
+        std::chrono::steady_clock::time_point now;
+        std::uint64_t nanos;  // since epoch
+        std::uint64_t tick;   // Tick since epoch
+        std::uint32_t second; // since epoch, for idle tracking
+    };
+
+    static constexpr int SLIDING_COUNT_BITS = 18;
+    static constexpr std::uint64_t SLIDING_COUNT_MASK = (std::uint64_t{1} << SLIDING_COUNT_BITS) - 1;
+    static constexpr std::uint64_t SLIDING_INDEX_MASK = (std::uint64_t{1} << (64 - 2 * SLIDING_COUNT_BITS)) - 1;
+    static constexpr int MAX_LOG_REQUESTS = 1 << 16; // caps SlidingWindowLog at 512KB per client
+    using Tick = std::chrono::milliseconds; // resolution of the sliding window algorithms
+
     const std::chrono::seconds windowSize;
     const int maxRequestsPerWindow;
-    std::unordered_map<int, ClientState> clientsStateMap;
-    std::mutex mapMtx; // mutable not required as allowRequest is not a const function
+    const RateLimiterMode mode;
+    const RateLimitAlgorithm algorithm;
+    const std::shared_ptr<const SteadyClockSource> clock; // nullptr reads steady_clock directly, saves the virtual call
+    const std::chrono::steady_clock::time_point epoch; // tick 0
+    const std::uint64_t windowTicks;
+    const PackedWindowRule packedRule; // FixedWindow in LockFree mode, TokenBucket
+    ClientTable clientsStateMap; // sharded, replaces the single map + mapMtx; bounded by idle eviction
+    std::atomic<RateLimiterMetrics*> metrics{nullptr}; // not owned
+
+    bool allowPerClientMutex(ClientState& client, const RequestTime& time);
+    bool admitInWindow(ClientState& client, const RequestTime& time); // caller holds client.clientMtx
+    bool allowPacked(ClientState& client, const RequestTime& time);
+    bool allowSlidingWindowCounter(ClientState& client, const RequestTime& time);
+    bool allowSlidingWindowLog(ClientState& client, const RequestTime& time);
+    bool decide(ClientState& client, const RequestTime& time);
+    bool allowAt(int clientId, const RequestTime& time);
+    std::chrono::steady_clock::time_point earliestAdmission(ClientState& client, const RequestTime& time);
+
+    RequestTime readClock() const{
+        RequestTime time;
+        time.now = clock ? clock -> now() : std::chrono::steady_clock::now();
+        auto elapsed = time.now - epoch;
+        time.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        time.tick = std::chrono::duration_cast<Tick>(elapsed).count();
+        time.second = static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(elapsed).count());
+        return time;
+    }
+
+    static std::int64_t clampLimit(RateLimitAlgorithm algorithm, std::int64_t limit){
+        switch(algorithm){
+            case RateLimitAlgorithm::SlidingWindowCounter: return std::min<std::int64_t>(limit, SLIDING_COUNT_MASK);
+            case RateLimitAlgorithm::SlidingWindowLog: return std::min<std::int64_t>(limit, MAX_LOG_REQUESTS);
+            default: return std::min<std::int64_t>(limit, PackedWindowRule::MAX_REQUESTS);
+        }
+    }
 
 public:
-    RateLimiter(std::chrono::seconds windowSize, int maxRequestsPerWindow) :
-        windowSize(windowSize), 
-        maxRequestsPerWindow(maxRequestsPerWindow){}
+    // shardCount is rounded up to a power of two, size it to a few times the number of cores calling allowRequest
+    RateLimiter(std::chrono::seconds windowSize, int maxRequestsPerWindow, RateLimiterMode mode = RateLimiterMode::PerClientMutex,
+        std::size_t shardCount = 64) :
+        RateLimiter(windowSize, maxRequestsPerWindow, RateLimitAlgorithm::FixedWindow, mode, shardCount){}
+
+    // mode only matters for FixedWindow, the other algorithms have a single implementation each.
+    // The limit is clamped to what the algorithm's state can count (see the constants above). 0 (or less) denies every
+    // request, as the original limiter did.
+    RateLimiter(std::chrono::seconds windowSize, int maxRequestsPerWindow, RateLimitAlgorithm algorithm,
+        RateLimiterMode mode = RateLimiterMode::PerClientMutex, std::size_t shardCount = 64, ClientEvictionPolicy eviction = {},
+        std::shared_ptr<const SteadyClockSource> clock = nullptr) :
+        windowSize(windowSize),
+        maxRequestsPerWindow(std::max<std::int64_t>(0, clampLimit(algorithm, maxRequestsPerWindow))),
+        mode(mode),
+        algorithm(algorithm),
+        clock(std::move(clock)),
+        epoch(this->clock ? this->clock -> now() : std::chrono::steady_clock::now()),
+        windowTicks(std::max<std::int64_t>(1, std::chrono::duration_cast<Tick>(windowSize).count())),
+        packedRule(windowSize, this->maxRequestsPerWindow, algorithm),
+        clientsStateMap(shardCount,
+            static_cast<std::uint32_t>((eviction.idleTtl.count() > 0 ? eviction.idleTtl : 2 * windowSize).count()),
+            eviction.maxTrackedClients){}
 
     bool allowRequest(int clientId);
+
+    // For keyed front ends: resolveId(nowSecond) turns the caller's key into a client id on the same clock read the
+    // decision uses. A negative id is rejected.
+    template<typename ResolveId>
+    bool allowRequestFor(ResolveId&& resolveId){
+        const RequestTime time = readClock();
+        int clientId = resolveId(time.second);
+        return clientId >= 0 && allowAt(clientId, time);
+    }
+
+    // When allowRequest(clientId) would next return true, now if it would right away, time_point::max() with a limit of 0
+    // (never). Takes nothing, so by then
+    // other requests may have used the capacity; AsyncRateLimiter rechecks and reschedules.
+    std::chrono::steady_clock::time_point nextAdmissionTime(int clientId);
+
+    // Micro-batch version for gateways: out[i] is the decision for clientIds[i], made in batch order per client.
+    // Groups the batch by shard, so each shard lock is taken once per batch (plus once more exclusively if the group
+    // has new clients), each distinct client is looked up once, and the clock is read once for the whole batch.
+    // (Pointer + count rather than std::span, this builds as C++17.)
+    void allowRequests(const int* clientIds, std::size_t count, bool* out);
+
+    void allowRequests(const std::vector<int>& clientIds, std::vector<bool>& out){
+        std::unique_ptr<bool[]> decisions = std::make_unique<bool[]>(clientIds.size());
+        allowRequests(clientIds.data(), clientIds.size(), decisions.get());
+        out.assign(decisions.get(), decisions.get() + clientIds.size());
+    }
+
+    // Eviction also happens incrementally on inserts, this is for a periodic full pass (e.g. from a maintenance thread)
+    std::size_t evictIdleClients(){
+        return clientsStateMap.evictIdleClients(readClock().second);
+    }
+
+    ClientTableStats getClientStats(){
+        return clientsStateMap.getStats();
+    }
+
+    std::chrono::seconds getWindowSize() const{
+        return windowSize;
+    }
+
+    // Seconds since the epoch on the limiter's clock, what idle tracking counts in
+    std::uint32_t getCurrentSecond() const{
+        return readClock().second;
+    }
+
+    // Every decision from now on is recorded into metrics (nullptr stops). Not owned, must outlive the attachment.
+    void attachMetrics(RateLimiterMetrics* newMetrics){
+        metrics.store(newMetrics, std::memory_order_release);
+    }
 };
 
 // bool RateLimiter::allowRequest(int clientId){
@@ -42,27 +982,1030 @@ public:
 // }
 
 bool RateLimiter::allowRequest(int clientId){
-    ClientState* client;
-    {
-        std::lock_guard<std::mutex> guard(mapMtx);
-        auto[it, inserted] = clientsStateMap.try_emplace(clientId, ClientState{std::chrono::steady_clock::now(), 0});
-        client = &it -> second;
+    return allowAt(clientId, readClock());
+}
+
+bool RateLimiter::allowAt(int clientId, const RequestTime& time){
+    // shared lock on one shard for the decision, exclusive only on first sight
+    bool allowed = clientsStateMap.withClient(clientId, time.second, [this, &time](ClientState& client){ return decide(client, time); });
+    if(RateLimiterMetrics* recorder = metrics.load(std::memory_order_acquire)) recorder -> record(clientId, allowed);
+    return allowed;
+}
+
+void RateLimiter::allowRequests(const int* clientIds, std::size_t count, bool* out){
+    const RequestTime time = readClock();
+    clientsStateMap.withClients(clientIds, count, time.second, [this, &time, out](ClientState& client, const std::uint32_t* positions, std::size_t runLength){
+        if(algorithm == RateLimitAlgorithm::FixedWindow && mode == RateLimiterMode::PerClientMutex){
+            // the client's mutex once for all of its requests in the batch
+            std::lock_guard<std::mutex> guard(client.clientMtx);
+            for(std::size_t i = 0; i < runLength; i++) out[positions[i]] = maxRequestsPerWindow != 0 && admitInWindow(client, time);
+            return;
+        }
+        for(std::size_t i = 0; i < runLength; i++) out[positions[i]] = decide(client, time);
+    });
+    if(RateLimiterMetrics* recorder = metrics.load(std::memory_order_acquire)){
+        for(std::size_t i = 0; i < count; i++) recorder -> record(clientIds[i], out[i]);
+    }
+}
+
+bool RateLimiter::decide(ClientState& client, const RequestTime& time){
+    if(maxRequestsPerWindow == 0) return false; // the packed rules and the log need a limit of at least 1
+    switch(algorithm){
+        case RateLimitAlgorithm::SlidingWindowCounter: return allowSlidingWindowCounter(client, time);
+        case RateLimitAlgorithm::SlidingWindowLog: return allowSlidingWindowLog(client, time);
+        case RateLimitAlgorithm::TokenBucket: return allowPacked(client, time);
+        case RateLimitAlgorithm::FixedWindow: break;
+    }
+    if(mode == RateLimiterMode::LockFree) return allowPacked(client, time);
+    return allowPerClientMutex(client, time);
+}
+
+std::chrono::steady_clock::time_point RateLimiter::nextAdmissionTime(int clientId){
+    const RequestTime time = readClock();
+    return clientsStateMap.withClient(clientId, time.second, [this, &time](ClientState& client){ return earliestAdmission(client, time); });
+}
+
+// Mirrors each decide path without changing the state
+std::chrono::steady_clock::time_point RateLimiter::earliestAdmission(ClientState& client, const RequestTime& time){
+    if(maxRequestsPerWindow == 0) return std::chrono::steady_clock::time_point::max();
+    const std::uint64_t limit = static_cast<std::uint64_t>(maxRequestsPerWindow);
+    switch(algorithm){
+        case RateLimitAlgorithm::TokenBucket:
+            return epoch + std::chrono::nanoseconds(packedRule.earliestAdmission(client.packedWindow.load(std::memory_order_relaxed), time.nanos));
+
+        case RateLimitAlgorithm::SlidingWindowCounter:{
+            std::uint64_t windowIndex = time.tick / windowTicks;
+            std::uint64_t offsetInWindow = time.tick % windowTicks;
+            std::uint64_t current = client.packedWindow.load(std::memory_order_relaxed);
+            std::uint64_t storedIndex = current >> (2 * SLIDING_COUNT_BITS);
+            std::uint64_t windowsPassed = ((windowIndex & SLIDING_INDEX_MASK) - storedIndex) & SLIDING_INDEX_MASK;
+            if(windowsPassed > SLIDING_INDEX_MASK / 2){
+                // stored window is ahead of this clock read: decide at its start, as allowSlidingWindowCounter does
+                windowIndex += (storedIndex - (windowIndex & SLIDING_INDEX_MASK)) & SLIDING_INDEX_MASK;
+                offsetInWindow = 0;
+                windowsPassed = 0;
+            }
+            std::uint64_t previousCount = windowsPassed == 0 ? (current >> SLIDING_COUNT_BITS) & SLIDING_COUNT_MASK :
+                                          windowsPassed == 1 ? current & SLIDING_COUNT_MASK : 0;
+            std::uint64_t currentCount = windowsPassed == 0 ? current & SLIDING_COUNT_MASK : 0;
+            if(previousCount * (windowTicks - offsetInWindow) + currentCount * windowTicks < limit * windowTicks) return time.now;
+
+            // the smallest offset where previous * (windowTicks - offset) + current * windowTicks < limit * windowTicks,
+            // in this window if current alone is under the limit, otherwise in the next one with current as previous
+            std::uint64_t windowStart = windowIndex * windowTicks;
+            if(currentCount < limit){
+                std::uint64_t offset = windowTicks - std::min(windowTicks, ((limit - currentCount) * windowTicks - 1) / previousCount);
+                if(offset < windowTicks) return epoch + Tick(windowStart + offset);
+            }
+            std::uint64_t offset = windowTicks - std::min(windowTicks, (limit * windowTicks - 1) / currentCount);
+            return epoch + Tick(windowStart + windowTicks + offset);
+        }
+
+        case RateLimitAlgorithm::SlidingWindowLog:{
+            std::lock_guard<std::mutex> guard(client.clientMtx);
+            if(client.requestLogSize < limit) return time.now;
+            return std::max(time.now, epoch + Tick(client.requestLog[client.requestLogHead] + windowTicks));
+        }
+
+        case RateLimitAlgorithm::FixedWindow: break;
+    }
+    if(mode == RateLimiterMode::LockFree){
+        return epoch + std::chrono::nanoseconds(packedRule.earliestAdmission(client.packedWindow.load(std::memory_order_relaxed), time.nanos));
     }
+    std::lock_guard<std::mutex> guard(client.clientMtx);
+    if(time.now - client.windowStartTime >= windowSize || client.requestsCounter < maxRequestsPerWindow) return time.now;
+    return client.windowStartTime + windowSize;
+}
 
-    std::lock_guard<std::mutex> guard(client -> clientMtx);
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = now - client -> windowStartTime;
+bool RateLimiter::allowPerClientMutex(ClientState& client, const RequestTime& time){
+    std::lock_guard<std::mutex> guard(client.clientMtx);
+    return admitInWindow(client, time);
+}
+
+bool RateLimiter::admitInWindow(ClientState& client, const RequestTime& time){
+    auto now = time.now;
+    auto elapsed = now - client.windowStartTime;
     if(elapsed >= windowSize){ // request at the boundary to be rejected
-        client -> windowStartTime = now;
-        client -> requestsCounter = 0;
+        client.windowStartTime = now;
+        client.requestsCounter = 0;
     }
 
-    return ++ client -> requestsCounter <= maxRequestsPerWindow;
+    return ++ client.requestsCounter <= maxRequestsPerWindow;
+}
+
+// FixedWindow in LockFree mode and TokenBucket: one atomic word, see PackedWindowRule
+bool RateLimiter::allowPacked(ClientState& client, const RequestTime& time){
+    std::uint64_t taken;
+    return packedRule.tryAcquire(client.packedWindow, time.nanos, taken);
+}
+
+// Estimate = previous window's count * the fraction of it still inside the sliding window + current count.
+// Only allowed requests are counted. Windows are aligned to the limiter's epoch.
+bool RateLimiter::allowSlidingWindowCounter(ClientState& client, const RequestTime& time){
+    const std::uint64_t nowTick = time.tick;
+    const std::uint64_t windowIndex = (nowTick / windowTicks) & SLIDING_INDEX_MASK;
+    const std::uint64_t offsetInWindow = nowTick % windowTicks;
+    std::uint64_t current = client.packedWindow.load(std::memory_order_relaxed);
+    while(true){
+        std::uint64_t storedIndex = current >> (2 * SLIDING_COUNT_BITS);
+        std::uint64_t previousCount = (current >> SLIDING_COUNT_BITS) & SLIDING_COUNT_MASK;
+        std::uint64_t currentCount = current & SLIDING_COUNT_MASK;
+        std::uint64_t windowsPassed = (windowIndex - storedIndex) & SLIDING_INDEX_MASK;
+        std::uint64_t decisionIndex = windowIndex;
+        std::uint64_t decisionOffset = offsetInWindow;
+        if(windowsPassed > SLIDING_INDEX_MASK / 2){
+            // a thread with a later clock read already moved the window on: never move it back, decide in the stored
+            // window as if at its very start (previous still fully weighted), which can only be stricter
+            windowsPassed = 0;
+            decisionIndex = storedIndex;
+            decisionOffset = 0;
+        }
+        if(windowsPassed == 1){
+            previousCount = currentCount;
+            currentCount = 0;
+        }
+        else if(windowsPassed > 1){
+            previousCount = 0;
+            currentCount = 0;
+        }
+
+        // previous * (windowTicks - offset) / windowTicks + current < limit, kept in integers
+        std::uint64_t weighted = previousCount * (windowTicks - decisionOffset) + currentCount * windowTicks;
+        if(weighted >= static_cast<std::uint64_t>(maxRequestsPerWindow) * windowTicks) return false;
+
+        std::uint64_t next = (decisionIndex << (2 * SLIDING_COUNT_BITS)) | (previousCount << SLIDING_COUNT_BITS) | (currentCount + 1);
+        if(client.packedWindow.compare_exchange_weak(current, next, std::memory_order_relaxed)) return true;
+    }
+}
+
+// Exact: allowed when fewer than limit requests were allowed in the last windowSize, i.e. when the oldest of the
+// last limit allowed requests has aged out. The ring holds exactly limit ticks, so the log never grows past that.
+bool RateLimiter::allowSlidingWindowLog(ClientState& client, const RequestTime& time){
+    std::lock_guard<std::mutex> guard(client.clientMtx);
+    const std::uint64_t nowTick = time.tick;
+    const std::uint32_t capacity = static_cast<std::uint32_t>(maxRequestsPerWindow);
+    if(!client.requestLog){
+        client.requestLog = std::make_unique<std::uint64_t[]>(capacity);
+        client.requestLogCapacity = capacity;
+    }
+
+    if(client.requestLogSize == capacity){
+        if(nowTick - client.requestLog[client.requestLogHead] < windowTicks) return false;
+        client.requestLog[client.requestLogHead] = nowTick; // overwrite the oldest, it's out of the window
+        client.requestLogHead = (client.requestLogHead + 1) % capacity;
+        return true;
+    }
+    client.requestLog[(client.requestLogHead + client.requestLogSize) % capacity] = nowTick;
+    client.requestLogSize++;
+    return true;
+}
+
+// -------- Async acquire --------
+
+// For callers that would rather wait than drop: acquire() hands back a future that becomes true once the limiter
+// admits the request (false if this queue is destroyed first). Waiters are parked per client in FIFO order and only the
+// head of each client's queue sits in a timer heap keyed by limiter.nextAdmissionTime(), so one timer thread sleeps
+// until the earliest of them with a single condition variable wait: no polling, no timer per waiter, and a client with
+// 100k waiters costs one heap entry. Parked queues are sharded by client, each shard with its own lock, so waiters on
+// one client don't serialise acquire() for the others; a newcomer checks its own client's queue under that lock, so it
+// never overtakes a parked waiter. The fast path (nothing parked in the shard) is allowRequest() plus a ready future.
+// Lock order is shard, then timer heap.
+// Waiting is on steady_clock, so the limiter should run on it (directly or through a CoarseClock), not a ManualClock.
+class AsyncRateLimiter{
+    static constexpr std::size_t SHARD_COUNT = 64;
+
+    struct Wakeup{
+        std::chrono::steady_clock::time_point time;
+        int clientId;
+
+        bool operator>(const Wakeup& other) const{
+            return time > other.time;
+        }
+    };
+
+    struct alignas(64) Shard{
+        std::mutex mtx;
+        std::unordered_map<int, std::deque<std::promise<bool>>> parked;
+        std::atomic<std::size_t> parkedCount{0}; // written under mtx, read without it by the fast path
+    };
+
+    // After a failed retry, don't retry sooner than this. A coarse limiter clock can lag steady_clock by up to its
+    // resolution, and retrying on every wake-up in that gap would be a spin.
+    static constexpr std::chrono::microseconds RETRY_FLOOR{200};
+
+    RateLimiter& limiter;
+    std::array<Shard, SHARD_COUNT> shards;
+    std::mutex timerMtx;
+    std::condition_variable wakeCv;
+    std::atomic<bool> stopping{false};
+    std::priority_queue<Wakeup, std::vector<Wakeup>, std::greater<Wakeup>> timers; // one entry per parked client
+    std::vector<std::promise<bool>> admitted; // timer thread only
+    std::thread timerThread; // declared last, started once everything above exists
+
+    static std::future<bool> ready(bool value){
+        std::promise<bool> promise;
+        promise.set_value(value);
+        return promise.get_future();
+    }
+
+    Shard& shardOf(int clientId){
+        return shards[(static_cast<std::uint32_t>(clientId) * 0x9E3779B9u) >> 26]; // top 6 bits, SHARD_COUNT = 64
+    }
+
+    void schedule(int clientId, std::chrono::steady_clock::time_point time){
+        std::lock_guard<std::mutex> guard(timerMtx);
+        bool earliest = timers.empty() || time < timers.top().time;
+        timers.push(Wakeup{time, clientId});
+        if(earliest) wakeCv.notify_one();
+    }
+
+    // Admits what the limiter allows from the head of clientId's queue and reschedules the rest
+    void admitDue(int clientId, std::chrono::steady_clock::time_point now){
+        Shard& shard = shardOf(clientId);
+        {
+            std::lock_guard<std::mutex> guard(shard.mtx);
+            auto found = shard.parked.find(clientId);
+            if(found == shard.parked.end()) return;
+            auto& waiters = found -> second;
+            while(!waiters.empty() && limiter.allowRequest(clientId)){
+                admitted.push_back(std::move(waiters.front()));
+                waiters.pop_front();
+            }
+            shard.parkedCount.fetch_sub(admitted.size(), std::memory_order_release);
+            if(waiters.empty()) shard.parked.erase(found);
+            else schedule(clientId, std::max(limiter.nextAdmissionTime(clientId), now + RETRY_FLOOR));
+        }
+        // fulfil outside the lock, woken callers may come straight back to acquire()
+        for(auto& promise : admitted) promise.set_value(true);
+        admitted.clear();
+    }
+
+    void timerLoop(){
+        std::unique_lock<std::mutex> lock(timerMtx);
+        while(!stopping.load(std::memory_order_relaxed)){
+            if(timers.empty()){
+                wakeCv.wait(lock);
+                continue;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if(timers.top().time > now){
+                wakeCv.wait_until(lock, timers.top().time);
+                continue;
+            }
+            int clientId = timers.top().clientId;
+            timers.pop();
+            lock.unlock(); // the shard lock comes first
+            admitDue(clientId, now);
+            lock.lock();
+        }
+    }
+
+public:
+    // limiter is not owned and must outlive this
+    explicit AsyncRateLimiter(RateLimiter& limiter) : limiter(limiter), timerThread(&AsyncRateLimiter::timerLoop, this){}
+
+    AsyncRateLimiter(const AsyncRateLimiter&) = delete;
+    AsyncRateLimiter& operator=(const AsyncRateLimiter&) = delete;
+
+    // Waiters still parked get false
+    ~AsyncRateLimiter(){
+        {
+            std::lock_guard<std::mutex> guard(timerMtx);
+            stopping.store(true, std::memory_order_relaxed);
+        }
+        wakeCv.notify_one();
+        timerThread.join();
+        for(Shard& shard : shards){
+            std::lock_guard<std::mutex> guard(shard.mtx);
+            for(auto& entry : shard.parked){
+                for(auto& promise : entry.second) promise.set_value(false);
+            }
+        }
+    }
+
+    std::future<bool> acquire(int clientId){
+        Shard& shard = shardOf(clientId);
+        // nobody parked in the shard: a waiter parked from now on was denied after this call began, allowing it is fair
+        if(shard.parkedCount.load(std::memory_order_acquire) == 0 && limiter.allowRequest(clientId)) return ready(true);
+
+        std::lock_guard<std::mutex> guard(shard.mtx);
+        if(stopping.load(std::memory_order_relaxed)) return ready(false);
+        auto found = shard.parked.find(clientId);
+        if(found == shard.parked.end() && limiter.allowRequest(clientId)) return ready(true);
+
+        std::promise<bool> promise;
+        std::future<bool> future = promise.get_future();
+        if(found == shard.parked.end()){
+            auto admission = limiter.nextAdmissionTime(clientId);
+            if(admission == std::chrono::steady_clock::time_point::max()) return ready(false); // a limit of 0 never admits
+            found = shard.parked.emplace(clientId, std::deque<std::promise<bool>>{}).first;
+            schedule(clientId, admission);
+        }
+        found -> second.push_back(std::move(promise));
+        shard.parkedCount.fetch_add(1, std::memory_order_release);
+        return future;
+    }
+
+    std::size_t getPendingCount() const{
+        std::size_t pending = 0;
+        for(const Shard& shard : shards) pending += shard.parkedCount.load(std::memory_order_relaxed);
+        return pending;
+    }
+};
+
+// -------- Keyed limiters --------
+
+// How a borrowed lookup key (what callers pass per request) relates to the owned copy kept once per distinct key.
+// Specialise for new key types: Owned, own(), borrow() and hash(); Key needs operator==.
+template<typename Key>
+struct KeyTraits;
+
+// API keys, IPs as text, ...
+template<>
+struct KeyTraits<std::string_view>{
+    using Owned = std::string;
+
+    static Owned own(std::string_view key){
+        return Owned(key);
+    }
+
+    static std::string_view borrow(const Owned& owned){
+        return owned;
+    }
+
+    static std::size_t hash(std::string_view key){
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+// Composite keys such as route + user
+template<>
+struct KeyTraits<std::pair<std::string_view, std::string_view>>{
+    using Owned = std::pair<std::string, std::string>;
+
+    static Owned own(const std::pair<std::string_view, std::string_view>& key){
+        return Owned(std::string(key.first), std::string(key.second));
+    }
+
+    static std::pair<std::string_view, std::string_view> borrow(const Owned& owned){
+        return {owned.first, owned.second};
+    }
+
+    static std::size_t hash(const std::pair<std::string_view, std::string_view>& key){
+        std::size_t first = std::hash<std::string_view>{}(key.first);
+        return first ^ (std::hash<std::string_view>{}(key.second) + 0x9E3779B97F4A7C15ull + (first << 6) + (first >> 2));
+    }
+};
+
+// Gives every distinct key a dense int id. The map's keys are borrowed views into the owned copies, so a lookup with a
+// view hashes and compares in place and only the first sight of a key allocates (C++17 has no heterogeneous
+// unordered_map lookup, this gets the same effect). Sharded like ClientTable: lookups share the shard lock, new keys
+// take it exclusively and sweep a few buckets for keys not seen for idleSeconds, whose ids go back to the shard's
+// free list. With idleSeconds at least the limiter's "loses nothing" horizon (2 * windowSize), whatever state the limiter
+// still has for a reused id is equivalent to a new client's, so reuse never carries one key's window over to another.
+// Memory is bounded by maxKeys live keys, and ids by maxKeys too, so they never wrap.
+template<typename Key>
+class KeyInterner{
+    using Traits = KeyTraits<Key>;
+    using Owned = typename Traits::Owned;
+
+    struct KeyHash{
+        std::size_t operator()(const Key& key) const{
+            return Traits::hash(key);
+        }
+    };
+
+    struct Entry{
+        std::unique_ptr<const Owned> owned; // the map key is a view into it, the heap copy never moves
+        int id = -1;
+        std::atomic<std::uint32_t> lastSeenSecond{0};
+    };
+
+    struct alignas(64) Shard{
+        std::shared_mutex mtx;
+        std::unordered_map<Key, Entry, KeyHash> ids;
+        std::vector<int> freeIds; // of reclaimed keys, handed out before new ones
+        std::size_t sweepCursor = 0;
+    };
+
+    static constexpr std::size_t SHARD_COUNT = 64;
+    static constexpr std::size_t SWEEP_BUCKETS_PER_INSERT = 4;
+
+    const std::uint32_t idleSeconds;
+    const std::size_t maxKeysPerShard;
+    std::array<Shard, SHARD_COUNT> shards;
+    std::atomic<std::uint32_t> nextId{0};
+    std::atomic<std::size_t> liveKeys{0};
+    std::atomic<std::uint64_t> reclaimedKeys{0};
+
+    // Under the shard's exclusive lock. Erasing doesn't rehash, so bucket indices stay valid while sweeping.
+    void sweepBuckets(Shard& shard, std::size_t bucketCount, std::uint32_t nowSecond){
+        std::vector<Key> idleKeys;
+        for(std::size_t i = 0; i < bucketCount; i++){
+            std::size_t bucket = shard.sweepCursor++ % shard.ids.bucket_count();
+            for(auto it = shard.ids.begin(bucket); it != shard.ids.end(bucket); ++it){
+                // a second later than ours comes from a thread with a newer clock read: seen just now, not long ago
+                std::uint32_t lastSeen = it -> second.lastSeenSecond.load(std::memory_order_relaxed);
+                if(lastSeen <= nowSecond && nowSecond - lastSeen > idleSeconds) idleKeys.push_back(it -> first);
+            }
+        }
+        for(const Key& key : idleKeys){
+            auto found = shard.ids.find(key);
+            shard.freeIds.push_back(found -> second.id);
+            shard.ids.erase(found); // frees the copy this key views, the remaining ones view other entries
+        }
+        liveKeys.fetch_sub(idleKeys.size(), std::memory_order_relaxed);
+        reclaimedKeys.fetch_add(idleKeys.size(), std::memory_order_relaxed);
+    }
+
+public:
+    // idleSeconds and nowSecond are on the clock of the limiter the ids are used with
+    KeyInterner(std::uint32_t idleSeconds, std::size_t maxKeys) :
+        idleSeconds(idleSeconds),
+        maxKeysPerShard(std::max<std::size_t>(1, std::min<std::size_t>(maxKeys, INT32_MAX) / SHARD_COUNT)){}
+
+    // The key's id, or -1 when its shard is full of keys seen within idleSeconds
+    int intern(const Key& key, std::uint32_t nowSecond){
+        std::uint64_t hash = static_cast<std::uint64_t>(Traits::hash(key)) * 0x9E3779B97F4A7C15ull;
+        Shard& shard = shards[(hash >> 32) % SHARD_COUNT];
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            auto found = shard.ids.find(key);
+            if(found != shard.ids.end()){
+                // only written when the second changes, repeat lookups leave the line clean
+                if(found -> second.lastSeenSecond.load(std::memory_order_relaxed) != nowSecond) found -> second.lastSeenSecond.store(nowSecond, std::memory_order_relaxed);
+                return found -> second.id;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        auto found = shard.ids.find(key);
+        if(found != shard.ids.end()) return found -> second.id; // interned by someone else in between
+        if(!shard.ids.empty()) sweepBuckets(shard, SWEEP_BUCKETS_PER_INSERT, nowSecond);
+        if(shard.ids.size() >= maxKeysPerShard) sweepBuckets(shard, shard.ids.bucket_count(), nowSecond);
+        if(shard.ids.size() >= maxKeysPerShard) return -1;
+
+        int id;
+        if(!shard.freeIds.empty()){
+            id = shard.freeIds.back();
+            shard.freeIds.pop_back();
+        }
+        else id = static_cast<int>(nextId.fetch_add(1, std::memory_order_relaxed)); // < SHARD_COUNT * maxKeysPerShard <= INT32_MAX
+        auto owned = std::make_unique<const Owned>(Traits::own(key));
+        Entry& entry = shard.ids.try_emplace(Traits::borrow(*owned)).first -> second;
+        entry.owned = std::move(owned);
+        entry.id = id;
+        entry.lastSeenSecond.store(nowSecond, std::memory_order_relaxed);
+        liveKeys.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    std::size_t size() const{
+        return liveKeys.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t getReclaimedCount() const{
+        return reclaimedKeys.load(std::memory_order_relaxed);
+    }
+};
+
+// RateLimiter over any key with KeyTraits: interns the key to an id and decides on that, so every algorithm, mode,
+// eviction and metrics option works unchanged. Callers with int ids keep using RateLimiter directly and pay nothing.
+// Keys idle for 2 * windowSize are forgotten along with their ids; past MAX_INTERNED_KEYS live keys, new keys are
+// rejected (fail closed) rather than grow the table.
+template<typename Key>
+class KeyedRateLimiter{
+    static constexpr std::size_t MAX_INTERNED_KEYS = std::size_t{1} << 22;
+
+    RateLimiter limiter;
+    KeyInterner<Key> interner; // after limiter, it takes the idle horizon from it
+
+public:
+    // Takes the same arguments as RateLimiter
+    template<typename... Args>
+    explicit KeyedRateLimiter(Args&&... args) :
+        limiter(std::forward<Args>(args)...),
+        interner(static_cast<std::uint32_t>((2 * limiter.getWindowSize()).count()), MAX_INTERNED_KEYS){}
+
+    bool allowRequest(const Key& key){
+        return limiter.allowRequestFor([this, &key](std::uint32_t nowSecond){ return interner.intern(key, nowSecond); });
+    }
+
+    // time_point::max() for a key that can't be interned
+    std::chrono::steady_clock::time_point nextAdmissionTime(const Key& key){
+        int id = interner.intern(key, limiter.getCurrentSecond());
+        return id >= 0 ? limiter.nextAdmissionTime(id) : std::chrono::steady_clock::time_point::max();
+    }
+
+    // The interned id, e.g. to look a key up in RateLimiterMetrics or to queue on an AsyncRateLimiter over getLimiter().
+    // -1 when the key can't be interned. Ids are reused once their key has been idle for 2 * windowSize.
+    int idOf(const Key& key){
+        return interner.intern(key, limiter.getCurrentSecond());
+    }
+
+    RateLimiter& getLimiter(){
+        return limiter;
+    }
+
+    std::size_t getInternedKeyCount() const{
+        return interner.size();
+    }
+
+    std::uint64_t getReclaimedKeyCount() const{
+        return interner.getReclaimedCount();
+    }
+};
+
+// -------- Hierarchical limits --------
+
+enum class LimitLevel{None, Client, Tenant, Global};
+
+struct LevelLimit{
+    std::chrono::seconds windowSize{1};
+    int maxRequestsPerWindow = 0; // 0 disables the level
+    RateLimitAlgorithm algorithm = RateLimitAlgorithm::TokenBucket; // FixedWindow or TokenBucket (the single-word ones)
+};
+
+struct HierarchicalDecision{
+    bool allowed = true;
+    LimitLevel rejectedBy = LimitLevel::None;
+};
+
+// Client, tenant and global limits in one call: client -> tenant -> global, each level acquired with its CAS and the
+// ones already taken released again when a later level rejects, so a request turned away anywhere keeps no budget.
+// The narrowest level goes first since it rejects most and is the least contended; the global word is only touched by
+// requests both their client and tenant would admit. In-flight reservations are visible for the few instructions
+// between acquire and release, so a concurrent request can be rejected where a serial order would have admitted it,
+// but no level is ever pushed past its limit.
+class HierarchicalRateLimiter{
+    const std::shared_ptr<const SteadyClockSource> clock; // nullptr reads steady_clock directly
+    const std::chrono::steady_clock::time_point epoch;
+    const LevelLimit clientLimit;
+    const LevelLimit tenantLimit;
+    const LevelLimit globalLimit;
+    const PackedWindowRule clientRule;
+    const PackedWindowRule tenantRule;
+    const PackedWindowRule globalRule;
+    ClientTable clients;
+    ClientTable tenants;
+    alignas(64) std::atomic<std::uint64_t> globalWindow{0};
+
+    static std::uint32_t idleTtlSeconds(const LevelLimit& limit, const ClientEvictionPolicy& eviction){
+        return static_cast<std::uint32_t>((eviction.idleTtl.count() > 0 ? eviction.idleTtl : 2 * limit.windowSize).count());
+    }
+
+public:
+    // eviction applies to the client table, tenants are assumed few and use the default TTL
+    HierarchicalRateLimiter(LevelLimit clientLimit, LevelLimit tenantLimit, LevelLimit globalLimit,
+        std::size_t shardCount = 64, ClientEvictionPolicy eviction = {}, std::shared_ptr<const SteadyClockSource> clock = nullptr) :
+        clock(std::move(clock)),
+        epoch(this->clock ? this->clock -> now() : std::chrono::steady_clock::now()),
+        clientLimit(clientLimit),
+        tenantLimit(tenantLimit),
+        globalLimit(globalLimit),
+        clientRule(clientLimit.windowSize, clientLimit.maxRequestsPerWindow, clientLimit.algorithm),
+        tenantRule(tenantLimit.windowSize, tenantLimit.maxRequestsPerWindow, tenantLimit.algorithm),
+        globalRule(globalLimit.windowSize, globalLimit.maxRequestsPerWindow, globalLimit.algorithm),
+        clients(shardCount, idleTtlSeconds(clientLimit, eviction), eviction.maxTrackedClients),
+        tenants(std::max<std::size_t>(1, shardCount / 4), idleTtlSeconds(tenantLimit, {}), 0){}
+
+    HierarchicalDecision allowRequest(int clientId, int tenantId){
+        auto elapsed = (clock ? clock -> now() : std::chrono::steady_clock::now()) - epoch;
+        const std::uint64_t nowNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        const std::uint32_t nowSecond = static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(elapsed).count());
+
+        return clients.withClient(clientId, nowSecond, [&](ClientState& client){
+            std::uint64_t clientTaken = 0;
+            if(clientLimit.maxRequestsPerWindow > 0 && !clientRule.tryAcquire(client.packedWindow, nowNanos, clientTaken)){
+                return HierarchicalDecision{false, LimitLevel::Client};
+            }
+            // tenant shard locked inside the client's: always client table then tenant table, eviction takes one at a time
+            HierarchicalDecision decision = tenants.withClient(tenantId, nowSecond, [&](ClientState& tenant){
+                std::uint64_t tenantTaken = 0;
+                if(tenantLimit.maxRequestsPerWindow > 0 && !tenantRule.tryAcquire(tenant.packedWindow, nowNanos, tenantTaken)){
+                    return HierarchicalDecision{false, LimitLevel::Tenant};
+                }
+                std::uint64_t globalTaken = 0;
+                if(globalLimit.maxRequestsPerWindow > 0 && !globalRule.tryAcquire(globalWindow, nowNanos, globalTaken)){
+                    if(tenantLimit.maxRequestsPerWindow > 0) tenantRule.release(tenant.packedWindow, tenantTaken);
+                    return HierarchicalDecision{false, LimitLevel::Global};
+                }
+                return HierarchicalDecision{};
+            });
+            if(!decision.allowed && clientLimit.maxRequestsPerWindow > 0) clientRule.release(client.packedWindow, clientTaken);
+            return decision;
+        });
+    }
+
+    ClientTableStats getClientStats(){
+        return clients.getStats();
+    }
+};
+
+// threadCount threads each make requestsPerThread calls, either all on one client (hot key) or one client per thread.
+// shardCount 1 is the old single-lock table.
+double measureNanosPerRequest(RateLimiter& rateLimiter, int threadCount, bool sharedClient){
+    const int requestsPerThread = 500000;
+    std::atomic<long long> allowed{0};
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; t++){
+        threads.emplace_back([&rateLimiter, &allowed, t, sharedClient, requestsPerThread](){
+            int clientId = sharedClient ? 0 : t;
+            long long allowedHere = 0;
+            for(int i = 0; i < requestsPerThread; i++) allowedHere += rateLimiter.allowRequest(clientId);
+            allowed += allowedHere;
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return elapsed / (static_cast<double>(threadCount) * requestsPerThread);
+}
+
+double measureNanosPerRequest(RateLimiterMode mode, int threadCount, bool sharedClient, int maxRequestsPerWindow, std::size_t shardCount = 64){
+    RateLimiter rateLimiter(std::chrono::seconds(1), maxRequestsPerWindow, mode, shardCount);
+    return measureNanosPerRequest(rateLimiter, threadCount, sharedClient);
+}
+
+// Contention benchmark: mutex path vs packed CAS path, on a hot client and on disjoint clients,
+// with a limit that is never hit (every request writes) and one that is hit almost at once (mostly rejects)
+void runRateLimiterContentionBenchmark(){
+    const int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "threads  client    limit    mutex ns/req  lock-free ns/req\n";
+    for(int threadCount = 1; threadCount <= maxThreads; threadCount *= 2){
+        for(bool sharedClient : {true, false}){
+            for(int limit : {1 << 23, 100}){
+                double mutexNanos = measureNanosPerRequest(RateLimiterMode::PerClientMutex, threadCount, sharedClient, limit);
+                double lockFreeNanos = measureNanosPerRequest(RateLimiterMode::LockFree, threadCount, sharedClient, limit);
+                std::cout << threadCount << "\t " << (sharedClient ? "shared  " : "distinct") << "  " << (limit == 100 ? "100    " : "8M     ")
+                          << "  " << mutexNanos << "\t\t" << lockFreeNanos << "\n";
+            }
+        }
+    }
+}
+
+// Disjoint clients (the common case) through one shard vs the default 64, lock-free decisions in both
+void runClientTableScalingBenchmark(){
+    const int maxThreads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "threads  1 shard ns/req  64 shards ns/req\n";
+    for(int threadCount = 1; threadCount <= maxThreads; threadCount *= 2){
+        std::cout << threadCount << "\t " << measureNanosPerRequest(RateLimiterMode::LockFree, threadCount, false, 1 << 23, 1)
+                  << "\t\t" << measureNanosPerRequest(RateLimiterMode::LockFree, threadCount, false, 1 << 23, 64) << "\n";
+    }
+}
+
+// Cost per decision for each algorithm, and how many requests each lets through in the 100ms around a window
+// boundary when a client sends its whole limit just before the boundary and again just after it.
+void runRateLimitAlgorithmBenchmark(){
+    const std::pair<RateLimitAlgorithm, const char*> algorithms[] = {
+        {RateLimitAlgorithm::FixedWindow, "FixedWindow (lock-free)"},
+        {RateLimitAlgorithm::SlidingWindowCounter, "SlidingWindowCounter   "},
+        {RateLimitAlgorithm::SlidingWindowLog, "SlidingWindowLog       "},
+        {RateLimitAlgorithm::TokenBucket, "TokenBucket (GCRA)     "}
+    };
+    const int threadCount = std::max(4u, std::thread::hardware_concurrency());
+    const int limit = 100;
+    std::cout << "algorithm                 ns/req (" << threadCount << " threads, distinct / shared client)  boundary burst (limit " << limit << ")\n";
+    for(const auto& [algorithm, name] : algorithms){
+        RateLimiter distinctLimiter(std::chrono::seconds(1), limit, algorithm, RateLimiterMode::LockFree);
+        RateLimiter sharedLimiter(std::chrono::seconds(1), limit, algorithm, RateLimiterMode::LockFree);
+        double distinctNanos = measureNanosPerRequest(distinctLimiter, threadCount, false);
+        double sharedNanos = measureNanosPerRequest(sharedLimiter, threadCount, true);
+
+        // window boundaries are aligned to the limiter's epoch for the lock-free/packed algorithms, line up on them
+        RateLimiter burstLimiter(std::chrono::seconds(1), limit, algorithm, RateLimiterMode::LockFree);
+        auto epoch = std::chrono::steady_clock::now();
+        burstLimiter.allowRequest(-1); // another client, just to touch the table
+        std::this_thread::sleep_until(epoch + std::chrono::milliseconds(950));
+        int allowed = 0;
+        for(int i = 0; i < 2 * limit; i++) allowed += burstLimiter.allowRequest(42);
+        std::this_thread::sleep_until(epoch + std::chrono::milliseconds(1050));
+        for(int i = 0; i < 2 * limit; i++) allowed += burstLimiter.allowRequest(42);
+
+        std::cout << name << "   " << distinctNanos << " / " << sharedNanos << "\t\t\t\t    " << allowed << "\n";
+    }
+}
+
+// Rotating client ids (every request from a new id, like short-lived sessions) at 100k new ids/s against a 1s window.
+// Without a cap the table levels off at a few TTLs worth of ids instead of growing forever; with one it stays at the cap.
+void runClientEvictionDemo(){
+    for(std::size_t maxTrackedClients : {std::size_t{0}, std::size_t{10000}}){
+        RateLimiter rateLimiter(std::chrono::seconds(1), 10, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree, 64,
+            ClientEvictionPolicy{std::chrono::seconds(0), maxTrackedClients});
+        std::size_t peakClients = 0;
+        auto start = std::chrono::steady_clock::now();
+        int clientId = 0;
+        for(int tick = 1; tick <= 600; tick++){ // 6s in 10ms steps
+            for(int i = 0; i < 1000; i++) rateLimiter.allowRequest(clientId++);
+            if(tick % 10 == 0) peakClients = std::max(peakClients, rateLimiter.getClientStats().trackedClients);
+            std::this_thread::sleep_until(start + tick * std::chrono::milliseconds(10));
+        }
+        ClientTableStats stats = rateLimiter.getClientStats();
+        std::cout << "Client eviction (cap " << maxTrackedClients << "): " << clientId << " ids seen, peak tracked " << peakClients
+                  << ", now " << stats.trackedClients << " (~" << stats.approximateBytes / 1024 << " KB), evicted idle "
+                  << stats.evictedIdle << ", for capacity " << stats.evictedForCapacity << "\n";
+    }
+}
+
+// 40 clients in 4 tenants (clientId % 4), client 0 sends half of all traffic. Client 0 runs into its own limit first,
+// then its tenant fills up, then the service as a whole: every rejection is attributed to exactly one level, and
+// requests rejected by tenant or global don't use up the client's budget.
+void runHierarchicalLimitDemo(){
+    HierarchicalRateLimiter rateLimiter(
+        LevelLimit{std::chrono::seconds(1), 50, RateLimitAlgorithm::FixedWindow},  // per client
+        LevelLimit{std::chrono::seconds(1), 150, RateLimitAlgorithm::FixedWindow}, // per tenant
+        LevelLimit{std::chrono::seconds(1), 500, RateLimitAlgorithm::FixedWindow}); // whole service
+    const int threadCount = 4;
+    std::array<std::atomic<long long>, 4> outcomes{}; // indexed by LimitLevel, None = allowed
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; t++){
+        threads.emplace_back([&rateLimiter, &outcomes, t](){
+            for(int i = 0; i < 5000; i++){
+                int clientId = i % 2 == 0 ? 0 : 1 + (i / 2 + t * 7) % 39;
+                HierarchicalDecision decision = rateLimiter.allowRequest(clientId, clientId % 4);
+                outcomes[static_cast<int>(decision.rejectedBy)]++;
+            }
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    std::cout << "Hierarchical limits: allowed " << outcomes[0] << " (global cap 500/s), rejected by client " << outcomes[1]
+              << ", tenant " << outcomes[2] << ", global " << outcomes[3] << "\n";
+}
+
+// Gateway-style micro-batches of 256 requests over 10k clients: one allowRequests call vs allowRequest in a loop.
+// ~100 requests per client against a limit of 50, in one 60s window, so both should make the same decision at every position.
+bool runBatchAllowBenchmark(){
+    const int batchSize = 256;
+    const int batches = 4000;
+    std::mt19937 rng(11);
+    std::vector<int> clientIds(static_cast<std::size_t>(batchSize) * batches);
+    for(int& clientId : clientIds) clientId = static_cast<int>(rng() % 10000);
+
+    bool allMatched = true;
+    for(RateLimiterMode mode : {RateLimiterMode::PerClientMutex, RateLimiterMode::LockFree}){
+        RateLimiter loopLimiter(std::chrono::seconds(60), 50, mode);
+        RateLimiter batchLimiter(std::chrono::seconds(60), 50, mode);
+        std::vector<char> loopDecisions(clientIds.size());
+        long long allowedLoop = 0;
+        long long mismatches = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < clientIds.size(); i++) loopDecisions[i] = loopLimiter.allowRequest(clientIds[i]);
+        double loopNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / clientIds.size();
+
+        std::unique_ptr<bool[]> out = std::make_unique<bool[]>(batchSize);
+        start = std::chrono::steady_clock::now();
+        for(int batch = 0; batch < batches; batch++){
+            const std::size_t first = static_cast<std::size_t>(batch) * batchSize;
+            batchLimiter.allowRequests(clientIds.data() + first, batchSize, out.get());
+            for(int i = 0; i < batchSize; i++) mismatches += out[i] != static_cast<bool>(loopDecisions[first + i]);
+        }
+        double batchNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / clientIds.size();
+
+        for(char allowed : loopDecisions) allowedLoop += allowed;
+        std::cout << "Batch of " << batchSize << " (" << (mode == RateLimiterMode::LockFree ? "lock-free" : "mutex") << "): loop "
+                  << loopNanos << " ns/req, allowRequests " << batchNanos << " ns/req, allowed " << allowedLoop << "/"
+                  << clientIds.size() << ", decisions differing = " << mismatches << "\n";
+        if(mismatches != 0) allMatched = false;
+    }
+    return allMatched;
+}
+
+// Per-request cost with the clock read on every call vs a 1ms CoarseClock, lock-free fixed window and GCRA
+void runCoarseClockBenchmark(){
+    auto coarseClock = std::make_shared<CoarseClock<std::chrono::steady_clock>>(std::chrono::milliseconds(1));
+    const int threadCount = std::max(4u, std::thread::hardware_concurrency());
+    for(RateLimitAlgorithm algorithm : {RateLimitAlgorithm::FixedWindow, RateLimitAlgorithm::TokenBucket}){
+        RateLimiter preciseLimiter(std::chrono::seconds(1), 1 << 20, algorithm, RateLimiterMode::LockFree);
+        RateLimiter coarseLimiter(std::chrono::seconds(1), 1 << 20, algorithm, RateLimiterMode::LockFree, 64, {}, coarseClock);
+        std::cout << (algorithm == RateLimitAlgorithm::FixedWindow ? "FixedWindow" : "TokenBucket") << " ns/req: steady_clock "
+                  << measureNanosPerRequest(preciseLimiter, threadCount, false) << ", CoarseClock "
+                  << measureNanosPerRequest(coarseLimiter, threadCount, false) << "\n";
+    }
+}
+
+// Zipf-ish traffic over 100k clients (a few very heavy ones) through a 100/s per-client limit: the heavy hitters should
+// come out on top with most of their traffic rejected, and the recording cost is shown next to the decision cost,
+// on one thread and with the same traffic split across threads (every thread recording into the same sketches)
+void runHeavyHitterMetricsDemo(){
+    const int requests = 2000000;
+    std::mt19937 rng(5);
+    std::vector<int> clientIds(requests);
+    for(int& clientId : clientIds){
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        clientId = static_cast<int>(std::pow(100000.0, u * u * u)) - 1; // heavily skewed towards small ids
+    }
+
+    // wall time per request with threadCount threads each taking every threadCount-th request
+    auto replay = [&clientIds, requests](RateLimiter& limiter, int threadCount){
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int t = 0; t < threadCount; t++){
+            threads.emplace_back([&limiter, &clientIds, requests, threadCount, t](){
+                for(int i = t; i < requests; i += threadCount) limiter.allowRequest(clientIds[i]);
+            });
+        }
+        for(auto& thread : threads) thread.join();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / requests;
+    };
+
+    RateLimiterMetrics metrics;
+    RateLimiter plainLimiter(std::chrono::seconds(1), 100, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+    RateLimiter measuredLimiter(std::chrono::seconds(1), 100, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+    measuredLimiter.attachMetrics(&metrics);
+    double plainNanos = replay(plainLimiter, 1);
+    double measuredNanos = replay(measuredLimiter, 1);
+    RateLimiterMetricsSnapshot snapshot = metrics.snapshot();
+
+    const int threadCount = std::max(4u, std::thread::hardware_concurrency());
+    RateLimiterMetrics sharedMetrics;
+    RateLimiter plainThreadedLimiter(std::chrono::seconds(1), 100, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+    RateLimiter measuredThreadedLimiter(std::chrono::seconds(1), 100, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+    measuredThreadedLimiter.attachMetrics(&sharedMetrics);
+    double plainThreadedNanos = replay(plainThreadedLimiter, threadCount);
+    double measuredThreadedNanos = replay(measuredThreadedLimiter, threadCount);
+
+    std::cout << "Heavy hitters: " << snapshot.totalAllowed << " allowed, " << snapshot.totalRejected << " rejected, sketch error <= "
+              << snapshot.sketchErrorBound << "; 1 thread " << plainNanos << " ns/req plain vs " << measuredNanos << " recorded, "
+              << threadCount << " threads " << plainThreadedNanos << " vs " << measuredThreadedNanos << "\n";
+    for(std::size_t i = 0; i < std::min<std::size_t>(5, snapshot.heaviestClients.size()); i++){
+        const HeavyHitter& hitter = snapshot.heaviestClients[i];
+        std::cout << "    client " << hitter.clientId << ": ~" << hitter.requests << " requests, ~" << hitter.rejected << " rejected\n";
+    }
+}
+
+// Forks workers that each attach to the segment by name and hammer the same 100 clients (limit 50 per minute), 16x
+// over the limit. The segment is first left half-initialised by a dead process, so opening it goes through the
+// takeover. Worker 0 runs until the parent SIGKILLs it, mid-decision almost surely. Whatever the survivors, the dead
+// worker and a final drain by the parent got must add up to 100 x 50: the killed worker may have taken one request it
+// never got to count, nothing more, and nothing is left wedged.
+bool runSharedMemoryLimiterDemo(){
+    const std::string name = "/lld_ratelimiter_demo";
+    const int workers = 4;
+    const int clients = 100;
+    const int limit = 50;
+    const int requestsPerWorker = 20000;
+    const std::size_t capacity = 4096;
+    SharedMemoryRateLimiter::unlink(name);
+    if(!SharedMemoryRateLimiter::abandonInitialisation(name, capacity)){
+        std::cout << "Shared-memory limiter: could not set up " << name << "\n";
+        return false;
+    }
+    auto openStart = std::chrono::steady_clock::now();
+    SharedMemoryRateLimiter limiter(name, std::chrono::minutes(1), limit, RateLimitAlgorithm::FixedWindow, capacity);
+    double openMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - openStart).count();
+    if(!limiter.isOpen()){
+        std::cout << "Shared-memory limiter: did not take over from the dead initialiser of " << name << "\n";
+        SharedMemoryRateLimiter::unlink(name);
+        return false;
+    }
+
+    // per-worker attempt and allowed counts, shared with the children so the killed one's counts survive it
+    const std::size_t countsBytes = sizeof(std::atomic<std::uint64_t>) * workers * 2;
+    void* countsMapping = ::mmap(nullptr, countsBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(countsMapping == MAP_FAILED) return false;
+    auto* allowedByWorker = static_cast<std::atomic<std::uint64_t>*>(countsMapping);
+    auto* attemptsByWorker = allowedByWorker + workers;
+    for(int i = 0; i < workers * 2; i++) new (&allowedByWorker[i]) std::atomic<std::uint64_t>(0);
+
+    std::vector<pid_t> children;
+    for(int worker = 0; worker < workers; worker++){
+        pid_t pid = ::fork();
+        if(pid == 0){
+            SharedMemoryRateLimiter own(name, std::chrono::minutes(1), limit, RateLimitAlgorithm::FixedWindow, capacity);
+            std::mt19937 rng(worker);
+            for(int i = 0; own.isOpen() && (worker == 0 || i < requestsPerWorker); i++){ // worker 0 until it is killed
+                attemptsByWorker[worker].fetch_add(1, std::memory_order_relaxed);
+                if(own.allowRequest(static_cast<int>(rng() % clients))) allowedByWorker[worker].fetch_add(1, std::memory_order_relaxed);
+            }
+            ::_exit(own.isOpen() ? 0 : 1);
+        }
+        if(pid > 0) children.push_back(pid);
+    }
+    bool ok = children.size() == static_cast<std::size_t>(workers);
+    if(!children.empty() && children[0] > 0){
+        while(attemptsByWorker[0].load(std::memory_order_relaxed) < static_cast<std::uint64_t>(requestsPerWorker / 2)){
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        ::kill(children[0], SIGKILL);
+    }
+    int killed = 0;
+    for(pid_t child : children){
+        int status = 0;
+        ::waitpid(child, &status, 0);
+        if(WIFSIGNALED(status)) killed++;
+        else if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    }
+
+    std::uint64_t allowedInWorkers = 0;
+    for(int worker = 0; worker < workers; worker++) allowedInWorkers += allowedByWorker[worker].load();
+    std::uint64_t drained = 0;
+    for(int clientId = 0; clientId < clients; clientId++){
+        while(limiter.allowRequest(clientId)) drained++;
+    }
+    const std::uint64_t expected = static_cast<std::uint64_t>(clients) * limit;
+    const std::uint64_t total = allowedInWorkers + drained;
+    ok = ok && killed == 1 && total <= expected && total + killed >= expected;
+    SharedLimiterStats stats = limiter.getStats();
+    std::cout << "Shared-memory limiter: took over a dead initialiser in " << openMillis << " ms, " << children.size()
+              << " workers (" << killed << " killed after " << attemptsByWorker[0].load() << " requests) allowed "
+              << allowedInWorkers << ", parent drained " << drained << ", total " << total << " of " << expected << ", "
+              << stats.usedSlots << "/" << stats.capacity << " slots used" << (ok ? "" : " MISMATCH") << "\n";
+
+    ::munmap(countsMapping, countsBytes);
+    SharedMemoryRateLimiter::unlink(name);
+    return ok;
+}
+
+// 200 clients x 1100 acquires against a 500/s token bucket: the burst is admitted at once and ~110k waiters park,
+// then drain at the limit's pace. Shows the peak backlog and that each client is paced rather than rejected.
+void runAsyncAcquireDemo(){
+    const int clients = 200;
+    const int acquiresPerClient = 1100;
+    const int limit = 500;
+    RateLimiter rateLimiter(std::chrono::seconds(1), limit, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+    AsyncRateLimiter asyncLimiter(rateLimiter);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<bool>> futures;
+    futures.reserve(static_cast<std::size_t>(clients) * acquiresPerClient);
+    for(int i = 0; i < acquiresPerClient; i++){
+        for(int clientId = 0; clientId < clients; clientId++) futures.push_back(asyncLimiter.acquire(clientId));
+    }
+    std::size_t peakPending = asyncLimiter.getPendingCount();
+    double enqueueMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    int admitted = 0;
+    for(auto& future : futures) admitted += future.get();
+    double drainSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Async acquire: " << futures.size() << " acquires in " << enqueueMillis << " ms, " << peakPending
+              << " parked, all " << admitted << " admitted after " << drainSeconds << " s (expected ~"
+              << static_cast<double>(acquiresPerClient - limit) / limit << " s)\n";
+}
+
+// Same traffic shape (10k clients, round robin) by int id, by API key string_view and by (route, user) pair.
+// The keyed limiters pay for hashing and interning lookups on top of the int path; none allocate per request.
+void runKeyedRateLimiterBenchmark(){
+    const int clients = 10000;
+    const int requests = 2000000;
+    std::vector<std::string> apiKeys;
+    std::vector<std::string> users;
+    for(int i = 0; i < clients; i++){
+        apiKeys.push_back("ak_live_" + std::to_string(1000000 + i) + "_7f3a9c");
+        users.push_back("user-" + std::to_string(i));
+    }
+    const std::string route = "/v1/orders";
+
+    RateLimiter byId(std::chrono::seconds(1), 100, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+    KeyedRateLimiter<std::string_view> byApiKey(std::chrono::seconds(1), 100, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+    KeyedRateLimiter<std::pair<std::string_view, std::string_view>> byRouteAndUser(std::chrono::seconds(1), 100,
+        RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree);
+
+    long long allowed[3] = {0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < requests; i++) allowed[0] += byId.allowRequest(i % clients);
+    double idNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / requests;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < requests; i++) allowed[1] += byApiKey.allowRequest(apiKeys[i % clients]);
+    double apiKeyNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / requests;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < requests; i++) allowed[2] += byRouteAndUser.allowRequest({route, users[i % clients]});
+    double compositeNanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / requests;
+
+    std::cout << "Keyed limiters: int " << idNanos << " ns/req, string_view " << apiKeyNanos << " ns/req, (route, user) "
+              << compositeNanos << " ns/req; allowed " << allowed[0] << "/" << allowed[1] << "/" << allowed[2]
+              << ", " << byApiKey.getInternedKeyCount() << " keys interned\n";
+
+    // Every request a never-seen key (attacker-chosen API keys), 10k per simulated second: idle keys are reclaimed, so the
+    // interned set stays around 3 seconds' worth (2 * windowSize + sweep lag) instead of growing with every key
+    auto clock = std::make_shared<ManualClock<std::chrono::steady_clock>>();
+    KeyedRateLimiter<std::string_view> churned(std::chrono::seconds(1), 100, RateLimitAlgorithm::TokenBucket, RateLimiterMode::LockFree,
+        64, ClientEvictionPolicy{}, clock);
+    std::size_t peakKeys = 0;
+    const int distinctKeys = 500000;
+    for(int i = 0; i < distinctKeys; i++){
+        churned.allowRequest("ak_spray_" + std::to_string(i));
+        if(i % 10000 == 9999) clock -> advance(std::chrono::seconds(1));
+        peakKeys = std::max(peakKeys, churned.getInternedKeyCount());
+    }
+    std::cout << "Keyed limiter under key churn: " << distinctKeys << " distinct keys, at most " << peakKeys << " interned at once, "
+              << churned.getReclaimedKeyCount() << " reclaimed\n";
 }
 
 int main() {
 
-    
+    int failedChecks = 0;
+    runRateLimiterContentionBenchmark();
+    runClientTableScalingBenchmark();
+    runRateLimitAlgorithmBenchmark();
+    runClientEvictionDemo();
+    runHierarchicalLimitDemo();
+    if(!runBatchAllowBenchmark()) failedChecks++;
+    runCoarseClockBenchmark();
+    runHeavyHitterMetricsDemo();
+    if(!runSharedMemoryLimiterDemo()) failedChecks++;
+    runAsyncAcquireDemo();
+    runKeyedRateLimiterBenchmark();
 
-    return 0;
-}
\ No newline at end of file
+    return failedChecks == 0 ? 0 : 1;
+}
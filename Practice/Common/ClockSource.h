@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Clock reads shared by the practice systems (ParkingLotSystem tickets, RateLimiter decisions).
+// ClockSource<Clock> is what they hold; pick one of:
+//   PreciseClock  Clock::now() on every read
+//   CoarseClock   a ticker thread publishes Clock::now() into an atomic every resolution, a read is one relaxed load.
+//                 Readers see time in resolution-sized steps and never go backwards (as long as Clock doesn't).
+//   ManualClock   only moves when set/advanced, for tests and trace replay
+template<typename Clock>
+class ClockSource{
+public:
+    using TimePoint = typename Clock::time_point;
+
+    virtual ~ClockSource() = default;
+    virtual TimePoint now() const = 0;
+};
+
+template<typename Clock>
+class PreciseClock final : public ClockSource<Clock>{
+public:
+    using TimePoint = typename Clock::time_point;
+
+    TimePoint now() const override{
+        return Clock::now();
+    }
+
+    static std::shared_ptr<const ClockSource<Clock>> instance(){
+        static const std::shared_ptr<const ClockSource<Clock>> clock = std::make_shared<PreciseClock>();
+        return clock;
+    }
+};
+
+template<typename Clock>
+class CoarseClock final : public ClockSource<Clock>{
+public:
+    using TimePoint = typename Clock::time_point;
+
+private:
+    const std::chrono::microseconds resolution;
+    alignas(64) std::atomic<typename Clock::rep> ticks; // own cache line, written once per resolution, read by everyone
+    std::mutex stopMtx;
+    std::condition_variable stopCv;
+    bool stopping = false;
+    std::thread ticker; // declared last, started once everything above exists
+
+    void tickerLoop(){
+        std::unique_lock<std::mutex> lock(stopMtx);
+        while(!stopCv.wait_for(lock, resolution, [this](){ return stopping; })){
+            ticks.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        }
+    }
+
+public:
+    // resolution is both the staleness bound and the ticker's wake-up period, 1ms costs ~1000 wake-ups/s
+    explicit CoarseClock(std::chrono::microseconds resolution = std::chrono::milliseconds(1)) :
+        resolution(std::max(resolution, std::chrono::microseconds(1))),
+        ticks(Clock::now().time_since_epoch().count()),
+        ticker(&CoarseClock::tickerLoop, this){}
+
+    CoarseClock(const CoarseClock&) = delete;
+    CoarseClock& operator=(const CoarseClock&) = delete;
+
+    ~CoarseClock(){
+        {
+            std::lock_guard<std::mutex> guard(stopMtx);
+            stopping = true;
+        }
+        stopCv.notify_one();
+        ticker.join();
+    }
+
+    TimePoint now() const override{
+        return TimePoint(typename Clock::duration(ticks.load(std::memory_order_relaxed)));
+    }
+
+    std::chrono::microseconds getResolution() const{
+        return resolution;
+    }
+};
+
+// Time only moves when someone sets it, safe to read from any thread
+template<typename Clock>
+class ManualClock final : public ClockSource<Clock>{
+public:
+    using TimePoint = typename Clock::time_point;
+
+private:
+    std::atomic<typename Clock::rep> ticks{0};
+
+public:
+    explicit ManualClock(TimePoint start = TimePoint{}) : ticks(start.time_since_epoch().count()){}
+
+    TimePoint now() const override{
+        return TimePoint(typename Clock::duration(ticks.load(std::memory_order_relaxed)));
+    }
+
+    void set(TimePoint timePoint){
+        ticks.store(timePoint.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    void advance(typename Clock::duration by){
+        ticks.fetch_add(by.count(), std::memory_order_relaxed);
+    }
+};